@@ -0,0 +1,104 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+
+// device side of a Walker alias table: picks index i with probability
+// weight[i] / sum(weight) from two uniforms in O(1), no search
+class AliasView
+{
+public:
+    const float *m_prob{ nullptr };
+    const unsigned int *m_alias{ nullptr };
+    unsigned int m_count{ 0 };
+
+    unsigned int sample(float u0, float u1) const
+    {
+        unsigned int i = sycl::min((unsigned int)(u0 * m_count), m_count - 1);
+        return u1 < m_prob[i] ? i : m_alias[i];
+    }
+};
+
+// builds the table on the host once (Vose's method, O(n)) and keeps it in
+// device memory, hand view() to the kernels
+class AliasTable
+{
+public:
+    float *m_prob{ nullptr };
+    unsigned int *m_alias{ nullptr };
+    unsigned int m_count{ 0 };
+    double m_total{ 0.0 }; // sum of the weights it was built from
+    sycl::queue q;
+public:
+    AliasTable(): q(sycl::gpu_selector_v) {}
+    AliasTable(const AliasTable &) = delete;
+    AliasTable &operator=(const AliasTable &) = delete;
+    ~AliasTable()
+    {
+        release();
+    }
+
+    // returns false if there is nothing to sample (empty or all zero weights)
+    bool build(const std::vector<float> &weights)
+    {
+        release();
+        size_t n = weights.size();
+        m_total = 0.0;
+        for (float w : weights)
+            m_total += w > 0.0f ? w : 0.0f;
+        if (n == 0 || m_total <= 0.0)
+            return false;
+
+        std::vector<float> prob(n);
+        std::vector<unsigned int> alias(n);
+        std::vector<double> scaled(n);
+        std::vector<unsigned int> small, large;
+        for (size_t i = 0; i < n; ++i)
+        {
+            scaled[i] = (weights[i] > 0.0f ? weights[i] : 0.0f) * n / m_total;
+            if (scaled[i] < 1.0)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+        while (!small.empty() && !large.empty())
+        {
+            unsigned int s = small.back();
+            unsigned int l = large.back();
+            small.pop_back();
+            prob[s] = (float)scaled[s];
+            alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // whatever is left is 1 up to rounding
+        for (unsigned int i : large) { prob[i] = 1.0f; alias[i] = i; }
+        for (unsigned int i : small) { prob[i] = 1.0f; alias[i] = i; }
+
+        m_count = n;
+        m_prob = sycl::malloc_device<float>(n, q);
+        m_alias = sycl::malloc_device<unsigned int>(n, q);
+        q.memcpy(m_prob, prob.data(), sizeof(float) * n);
+        q.memcpy(m_alias, alias.data(), sizeof(unsigned int) * n);
+        q.wait();
+        return true;
+    }
+
+    AliasView view() const
+    {
+        return AliasView{ m_prob, m_alias, m_count };
+    }
+
+private:
+    void release()
+    {
+        if (m_prob) sycl::free(m_prob, q);
+        if (m_alias) sycl::free(m_alias, q);
+        m_prob = nullptr;
+        m_alias = nullptr;
+        m_count = 0;
+    }
+};
@@ -0,0 +1,181 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <algorithm>
+#include "particle.hpp"
+
+// point attractors (.w > 0) and repulsors (.w < 0), pulling with
+// off * w / (|off|^2 + m_softening). the exact field is evaluated tile by
+// tile: a work-group stages ATTRACTOR_TILE attractors in local memory and
+// every work-item sums them in registers, so each attractor is read from
+// global memory once per work-group instead of once per particle.
+// above m_gridThreshold attractors the field is baked once per upload() into
+// a coarse grid and the particles only do a trilinear lookup.
+
+const size_t ATTRACTOR_TILE = 128;
+
+// sum of the pulls of attractors[0, count) at pos, every work-item of the
+// group has to call it (barriers inside)
+inline sycl::vec<float, 4> attractor_pull(sycl::nd_item<1> it, const sycl::local_accessor<sycl::vec<float, 4>, 1> &tile,
+                                          const sycl::vec<float, 4> *attractors, size_t count, sycl::vec<float, 4> pos, float softening)
+{
+    size_t lid = it.get_local_id(0);
+    sycl::vec<float, 4> a(0.0f);
+    for (size_t base = 0; base < count; base += ATTRACTOR_TILE)
+    {
+        // past the end loads a zero force, harmless in the sum
+        tile[lid] = base + lid < count ? attractors[base + lid] : sycl::vec<float, 4>(0.0f);
+        sycl::group_barrier(it.get_group());
+        size_t n = sycl::min(ATTRACTOR_TILE, count - base);
+        for (size_t j = 0; j < n; ++j)
+        {
+            sycl::vec<float, 4> att = tile[j];
+            sycl::vec<float, 4> off(att.x() - pos.x(), att.y() - pos.y(), att.z() - pos.z(), 0.0f);
+            a += off * (att.w() / (sycl::dot(off, off) + softening));
+        }
+        sycl::group_barrier(it.get_group());
+    }
+    return a;
+}
+
+class AttractorField
+{
+public:
+    std::vector<sycl::vec<float, 4>> m_attractors; // host copy, .w is force, edit then call upload()
+    float m_softening{ 1.0f }; // keeps the pull finite next to an attractor
+    size_t m_gridThreshold{ 4096 };
+    size_t m_gridRes{ 32 };   // nodes per axis
+    sycl::vec<float, 4> m_gridMin{ -1000.0f, -1000.0f, -1000.0f, 0.0f };
+    sycl::vec<float, 4> m_gridMax{ 1000.0f, 1000.0f, 1000.0f, 0.0f };
+    sycl::queue q;
+private:
+    sycl::vec<float, 4> *m_devAttractors{ nullptr };
+    sycl::vec<float, 4> *m_grid{ nullptr }; // baked pull per node, only above the threshold
+    size_t m_count{ 0 };
+    size_t m_capacity{ 0 };
+    bool m_dirty{ false };
+public:
+    AttractorField(): q(sycl::gpu_selector_v) {}
+    AttractorField(const AttractorField &) = delete;
+    AttractorField &operator=(const AttractorField &) = delete;
+    ~AttractorField()
+    {
+        if (m_devAttractors) sycl::free(m_devAttractors, q);
+        if (m_grid) sycl::free(m_grid, q);
+    }
+
+    size_t size() const { return m_attractors.size(); }
+    bool gridded() const { return m_count > m_gridThreshold; }
+
+    void add(const sycl::vec<float, 4> &attr)
+    {
+        m_attractors.push_back(attr);
+        m_dirty = true;
+    }
+
+    void upload()
+    {
+        m_count = m_attractors.size();
+        m_dirty = false;
+        if (m_count > m_capacity)
+        {
+            if (m_devAttractors) sycl::free(m_devAttractors, q);
+            m_capacity = m_count;
+            m_devAttractors = sycl::malloc_device<sycl::vec<float, 4>>(m_capacity, q);
+        }
+        if (m_count == 0) return;
+        q.memcpy(m_devAttractors, m_attractors.data(), sizeof(sycl::vec<float, 4>) * m_count).wait();
+        if (gridded()) bake();
+    }
+
+    // adds dt * pull to the velocity of every live particle
+    void apply(double dt, Particle_system &p)
+    {
+        if (m_dirty) upload();
+        if (m_count == 0 || p.m_highWater == 0) return;
+        const size_t endId = p.m_highWater;
+        const float localDT = (float)dt;
+        const sycl::vec<float, 4> *attractors = m_devAttractors;
+        const size_t count = m_count;
+        const float softening = m_softening;
+        Particle *buf_acc = p.m_particle;
+        const unsigned char *alive_acc = p.m_alive;
+
+        if (gridded())
+        {
+            const sycl::vec<float, 4> *grid = m_grid;
+            const size_t res = m_gridRes;
+            const sycl::vec<float, 4> gmin = m_gridMin;
+            const sycl::vec<float, 4> cell = (m_gridMax - m_gridMin) / (float)(m_gridRes - 1);
+            q.submit([&](sycl::handler &h){
+                h.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                    size_t idx = idx_d.get(0);
+                    if (alive_acc[idx] == 0) return;
+                    buf_acc[idx].vel += localDT * grid_lookup(grid, res, gmin, cell, buf_acc[idx].pos);
+                });
+            }).wait();
+            return;
+        }
+
+        const size_t global = (endId + ATTRACTOR_TILE - 1) / ATTRACTOR_TILE * ATTRACTOR_TILE;
+        q.submit([&](sycl::handler &h){
+            sycl::local_accessor<sycl::vec<float, 4>, 1> tile(sycl::range<1>(ATTRACTOR_TILE), h);
+            h.parallel_for(sycl::nd_range<1>(global, ATTRACTOR_TILE), [=](sycl::nd_item<1> it){
+                size_t idx = it.get_global_id(0);
+                // no early return, the whole group takes part in the staging
+                bool live = idx < endId && alive_acc[idx] != 0;
+                sycl::vec<float, 4> pos = live ? buf_acc[idx].pos : sycl::vec<float, 4>(0.0f);
+                sycl::vec<float, 4> a = attractor_pull(it, tile, attractors, count, pos, softening);
+                if (live)
+                    buf_acc[idx].vel += localDT * a;
+            });
+        }).wait();
+    }
+
+private:
+    // trilinear, positions outside the grid take the value of the nearest border
+    static sycl::vec<float, 4> grid_lookup(const sycl::vec<float, 4> *grid, size_t res, sycl::vec<float, 4> gmin, sycl::vec<float, 4> cell, sycl::vec<float, 4> pos)
+    {
+        float top = (float)(res - 1) - 0.001f;
+        float fx = sycl::clamp((pos.x() - gmin.x()) / cell.x(), 0.0f, top);
+        float fy = sycl::clamp((pos.y() - gmin.y()) / cell.y(), 0.0f, top);
+        float fz = sycl::clamp((pos.z() - gmin.z()) / cell.z(), 0.0f, top);
+        size_t x = (size_t)fx, y = (size_t)fy, z = (size_t)fz;
+        float tx = fx - x, ty = fy - y, tz = fz - z;
+        auto at = [&](size_t i, size_t j, size_t k){ return grid[(k * res + j) * res + i]; };
+        sycl::vec<float, 4> c00 = sycl::mix(at(x, y, z), at(x + 1, y, z), sycl::vec<float, 4>(tx));
+        sycl::vec<float, 4> c10 = sycl::mix(at(x, y + 1, z), at(x + 1, y + 1, z), sycl::vec<float, 4>(tx));
+        sycl::vec<float, 4> c01 = sycl::mix(at(x, y, z + 1), at(x + 1, y, z + 1), sycl::vec<float, 4>(tx));
+        sycl::vec<float, 4> c11 = sycl::mix(at(x, y + 1, z + 1), at(x + 1, y + 1, z + 1), sycl::vec<float, 4>(tx));
+        sycl::vec<float, 4> c0 = sycl::mix(c00, c10, sycl::vec<float, 4>(ty));
+        sycl::vec<float, 4> c1 = sycl::mix(c01, c11, sycl::vec<float, 4>(ty));
+        return sycl::mix(c0, c1, sycl::vec<float, 4>(tz));
+    }
+
+    // the exact field at every node, same tiled kernel as the particles
+    void bake()
+    {
+        const size_t res = m_gridRes;
+        const size_t nodes = res * res * res;
+        if (m_grid) sycl::free(m_grid, q);
+        m_grid = sycl::malloc_device<sycl::vec<float, 4>>(nodes, q);
+        sycl::vec<float, 4> *grid = m_grid;
+        const sycl::vec<float, 4> *attractors = m_devAttractors;
+        const size_t count = m_count;
+        const float softening = m_softening;
+        const sycl::vec<float, 4> gmin = m_gridMin;
+        const sycl::vec<float, 4> cell = (m_gridMax - m_gridMin) / (float)(m_gridRes - 1);
+        const size_t global = (nodes + ATTRACTOR_TILE - 1) / ATTRACTOR_TILE * ATTRACTOR_TILE;
+        q.submit([&](sycl::handler &h){
+            sycl::local_accessor<sycl::vec<float, 4>, 1> tile(sycl::range<1>(ATTRACTOR_TILE), h);
+            h.parallel_for(sycl::nd_range<1>(global, ATTRACTOR_TILE), [=](sycl::nd_item<1> it){
+                size_t n = it.get_global_id(0);
+                size_t i = n % res, j = (n / res) % res, k = n / (res * res);
+                sycl::vec<float, 4> pos = gmin + sycl::vec<float, 4>((float)i * cell.x(), (float)j * cell.y(), (float)k * cell.z(), 0.0f);
+                sycl::vec<float, 4> a = attractor_pull(it, tile, attractors, count, pos, softening);
+                if (n < nodes)
+                    grid[n] = a;
+            });
+        }).wait();
+    }
+};
@@ -0,0 +1,384 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "particle.hpp"
+#include "parallel_sycl_sorting.hpp"
+
+// particles pulling on each other through a Barnes-Hut octree, built on the
+// device every frame:
+//  - bounding cube of the live particles (group reductions, one atomic per group)
+//  - 30 bit morton code per particle, radix sorted with the slot as value
+//  - the linear octree level by level: a node of level l is a run of codes
+//    sharing their top 3 * l bits, found with a flag + scan per level
+//  - mass and center of mass bottom-up, a node sums its children
+// the traversal walks the tree per particle with a small stack and opens a
+// node only when its size / distance is above m_theta. the nodes on the
+// particle's own path are always opened, with a large m_theta its distance to
+// their center of mass can be smaller than their size and it would pull on
+// itself.
+
+const unsigned int BH_DEPTH = 10; // 10 bits per axis
+const unsigned int BH_NO_KEY = 0xffffffffu; // dead slots, sorted past every live one
+const unsigned int BH_STACK = 96;
+const size_t BH_GROUP = 256;
+
+class BhNode
+{
+public:
+    sycl::vec<float, 4> com; // center of mass in xyz, total mass in w
+    unsigned int start;      // run of sorted particles
+    unsigned int count;
+    unsigned int firstChild; // node index, children are contiguous
+    unsigned int childCount;
+    unsigned int level;
+};
+
+// 10 bits spread out to every third bit
+inline unsigned int morton_spread(unsigned int v)
+{
+    v &= 0x3ffu;
+    v = (v | (v << 16)) & 0x030000ffu;
+    v = (v | (v << 8)) & 0x0300f00fu;
+    v = (v | (v << 4)) & 0x030c30c3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+}
+
+// cell of pos in the cube of bounds[6..9], a node of level l holds the codes
+// sharing their top 3 * l bits
+inline unsigned int bh_key(const sycl::vec<float, 4> &pos, const float *bounds)
+{
+    float scale = (float)(1u << BH_DEPTH) / bounds[9];
+    unsigned int c[3];
+    for (int a = 0; a < 3; ++a)
+        c[a] = (unsigned int)sycl::clamp((pos[a] - bounds[6 + a]) * scale, 0.0f, (float)((1u << BH_DEPTH) - 1));
+    return (morton_spread(c[0]) << 2) | (morton_spread(c[1]) << 1) | morton_spread(c[2]);
+}
+
+class BarnesHut
+{
+public:
+    float m_theta{ 0.5f };       // opening angle, 0 is exact
+    float m_G{ 1000.0f };
+    float m_particleMass{ 1.0f };
+    float m_softening{ 5.0f };   // keeps close pairs from exploding
+    unsigned int m_leafSize{ 8 }; // nodes this small are summed particle by particle
+    size_t m_nodeCount{ 0 };
+    size_t m_liveCount{ 0 };
+    sycl::queue q;
+private:
+    unsigned int *m_keys{ nullptr };
+    unsigned int *m_values{ nullptr }; // particle slots in morton order
+    unsigned int *m_tmpKeys{ nullptr };
+    unsigned int *m_tmpValues{ nullptr };
+    unsigned int *m_hist{ nullptr };
+    unsigned int *m_scratch{ nullptr };
+    unsigned int *m_flags{ nullptr };
+    unsigned int *m_nodeIdx{ nullptr };
+    unsigned int *m_live{ nullptr };
+    float *m_bounds{ nullptr }; // min xyz, max xyz, then the cube: origin xyz, edge
+    BhNode *m_nodes{ nullptr };
+    size_t m_nodeCapacity{ 0 };
+    size_t m_capacity{ 0 };
+    size_t m_levelOffset[BH_DEPTH + 2]{};
+public:
+    BarnesHut(): q(sycl::gpu_selector_v)
+    {
+        m_bounds = sycl::malloc_device<float>(10, q);
+        m_live = sycl::malloc_device<unsigned int>(1, q);
+    }
+    BarnesHut(const BarnesHut &) = delete;
+    BarnesHut &operator=(const BarnesHut &) = delete;
+    ~BarnesHut()
+    {
+        release();
+        if (m_nodes) sycl::free(m_nodes, q);
+        sycl::free(m_bounds, q);
+        sycl::free(m_live, q);
+    }
+
+    // rebuilds the tree and adds dt * pull to every live particle's velocity
+    void update(double dt, Particle_system &p)
+    {
+        build(p);
+        apply(dt, p);
+    }
+
+    void build(Particle_system &p)
+    {
+        const size_t endId = p.m_highWater;
+        m_nodeCount = 0;
+        m_liveCount = 0;
+        if (endId == 0) return;
+        if (endId > m_capacity)
+        {
+            release();
+            m_capacity = p.size;
+            m_keys = sycl::malloc_device<unsigned int>(m_capacity, q);
+            m_values = sycl::malloc_device<unsigned int>(m_capacity, q);
+            m_tmpKeys = sycl::malloc_device<unsigned int>(m_capacity, q);
+            m_tmpValues = sycl::malloc_device<unsigned int>(m_capacity, q);
+            m_hist = sycl::malloc_device<unsigned int>(device_radix_hist(m_capacity), q);
+            // scans of the radix histograms and of the per level flags
+            m_scratch = sycl::malloc_device<unsigned int>(std::max(device_scan_scratch(device_radix_hist(m_capacity)), device_scan_scratch(m_capacity)), q);
+            m_flags = sycl::malloc_device<unsigned int>(m_capacity, q);
+            m_nodeIdx = sycl::malloc_device<unsigned int>(m_capacity + 1, q);
+        }
+
+        const Particle *buf_acc = p.m_particle;
+        const unsigned char *alive_acc = p.m_alive;
+        float *bounds = m_bounds;
+        unsigned int *live = m_live;
+        const size_t global = (endId + BH_GROUP - 1) / BH_GROUP * BH_GROUP;
+
+        const float inf = std::numeric_limits<float>::infinity();
+        const float init[6] = { inf, inf, inf, -inf, -inf, -inf };
+        q.memcpy(bounds, init, sizeof(init));
+        q.memset(live, 0, sizeof(unsigned int));
+        q.wait();
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::nd_range<1>(global, BH_GROUP), [=](sycl::nd_item<1> it){
+                size_t idx = it.get_global_id(0);
+                bool on = idx < endId && alive_acc[idx] != 0;
+                sycl::vec<float, 4> pos = on ? buf_acc[idx].pos : sycl::vec<float, 4>(0.0f);
+                auto g = it.get_group();
+                float lo[3], hi[3];
+                for (int a = 0; a < 3; ++a)
+                {
+                    lo[a] = sycl::reduce_over_group(g, on ? pos[a] : inf, sycl::minimum<float>());
+                    hi[a] = sycl::reduce_over_group(g, on ? pos[a] : -inf, sycl::maximum<float>());
+                }
+                unsigned int n = sycl::reduce_over_group(g, on ? 1u : 0u, sycl::plus<unsigned int>());
+                if (it.get_local_id(0) != 0 || n == 0) return;
+                for (int a = 0; a < 3; ++a)
+                {
+                    sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device> lo_ref(bounds[a]);
+                    sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device> hi_ref(bounds[3 + a]);
+                    lo_ref.fetch_min(lo[a]);
+                    hi_ref.fetch_max(hi[a]);
+                }
+                sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device> live_ref(*live);
+                live_ref.fetch_add(n);
+            });
+        }).wait();
+        unsigned int liveCount = 0;
+        q.copy<unsigned int>(live, &liveCount, 1).wait();
+        m_liveCount = liveCount;
+        if (liveCount == 0) return;
+
+        // cube around the box, a hair bigger so the max corner stays inside
+        q.single_task([=](){
+            float edge = sycl::max(bounds[3] - bounds[0], sycl::max(bounds[4] - bounds[1], bounds[5] - bounds[2]));
+            edge = edge * 1.001f + 1e-3f;
+            for (int a = 0; a < 3; ++a)
+                bounds[6 + a] = bounds[a];
+            bounds[9] = edge;
+        }).wait();
+
+        unsigned int *keys = m_keys;
+        unsigned int *values = m_values;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                values[idx] = (unsigned int)idx;
+                if (alive_acc[idx] == 0)
+                {
+                    keys[idx] = BH_NO_KEY;
+                    return;
+                }
+                keys[idx] = bh_key(buf_acc[idx].pos, bounds);
+            });
+        }).wait();
+        device_radix_sort(q, m_keys, m_values, endId, m_tmpKeys, m_tmpValues, m_hist, m_scratch);
+
+        // nodes of every level, top-down
+        const size_t n = liveCount;
+        unsigned int *flags = m_flags;
+        unsigned int *nodeIdx = m_nodeIdx;
+        size_t offset = 0;
+        for (unsigned int l = 0; l <= BH_DEPTH; ++l)
+        {
+            const unsigned int shift = 3 * (BH_DEPTH - l);
+            q.submit([&](sycl::handler &h){
+                h.parallel_for(sycl::range<1>(n), [=](sycl::id<1> i_d){
+                    size_t i = i_d.get(0);
+                    flags[i] = (i == 0 || (keys[i] >> shift) != (keys[i - 1] >> shift)) ? 1u : 0u;
+                });
+            }).wait();
+            device_exclusive_scan(q, flags, nodeIdx, n, m_scratch);
+            unsigned int levelNodes = 0;
+            q.copy<unsigned int>(nodeIdx + n, &levelNodes, 1).wait();
+            reserve(offset + levelNodes);
+
+            BhNode *nodes = m_nodes + offset;
+            q.submit([&](sycl::handler &h){
+                h.parallel_for(sycl::range<1>(n), [=](sycl::id<1> i_d){
+                    size_t i = i_d.get(0);
+                    if (flags[i] == 0) return;
+                    nodes[nodeIdx[i]].start = (unsigned int)i;
+                    nodes[nodeIdx[i]].level = l;
+                });
+            }).wait();
+            q.submit([&](sycl::handler &h){
+                h.parallel_for(sycl::range<1>(levelNodes), [=](sycl::id<1> k_d){
+                    size_t k = k_d.get(0);
+                    unsigned int end = k + 1 < levelNodes ? nodes[k + 1].start : (unsigned int)n;
+                    nodes[k].count = end - nodes[k].start;
+                });
+            }).wait();
+            m_levelOffset[l] = offset;
+            offset += levelNodes;
+        }
+        m_levelOffset[BH_DEPTH + 1] = offset;
+        m_nodeCount = offset;
+
+        // mass bottom-up
+        const float mass = m_particleMass;
+        for (int l = BH_DEPTH; l >= 0; --l)
+        {
+            BhNode *all = m_nodes;
+            const size_t first = m_levelOffset[l];
+            const size_t levelNodes = m_levelOffset[l + 1] - first;
+            const size_t childFirst = m_levelOffset[l + 1];
+            const size_t childNodes = l < (int)BH_DEPTH ? m_levelOffset[l + 2] - childFirst : 0;
+            q.submit([&](sycl::handler &h){
+                h.parallel_for(sycl::range<1>(levelNodes), [=](sycl::id<1> k_d){
+                    BhNode &node = all[first + k_d.get(0)];
+                    sycl::vec<float, 4> sum(0.0f);
+                    if (childNodes == 0)
+                    {
+                        for (unsigned int i = node.start; i < node.start + node.count; ++i)
+                        {
+                            sycl::vec<float, 4> pos = buf_acc[values[i]].pos;
+                            sum += sycl::vec<float, 4>(pos.x() * mass, pos.y() * mass, pos.z() * mass, mass);
+                        }
+                        node.firstChild = 0;
+                        node.childCount = 0;
+                    }
+                    else
+                    {
+                        // children are the next level's runs starting inside ours
+                        auto lower = [&](unsigned int s){
+                            size_t lo = 0, hi = childNodes;
+                            while (lo < hi)
+                            {
+                                size_t mid = (lo + hi) / 2;
+                                if (all[childFirst + mid].start < s) lo = mid + 1;
+                                else hi = mid;
+                            }
+                            return lo;
+                        };
+                        size_t c0 = lower(node.start);
+                        size_t c1 = lower(node.start + node.count);
+                        for (size_t c = c0; c < c1; ++c)
+                        {
+                            sycl::vec<float, 4> cm = all[childFirst + c].com;
+                            sum += sycl::vec<float, 4>(cm.x() * cm.w(), cm.y() * cm.w(), cm.z() * cm.w(), cm.w());
+                        }
+                        node.firstChild = (unsigned int)(childFirst + c0);
+                        node.childCount = (unsigned int)(c1 - c0);
+                    }
+                    node.com = sycl::vec<float, 4>(sum.x() / sum.w(), sum.y() / sum.w(), sum.z() / sum.w(), sum.w());
+                });
+            }).wait();
+        }
+    }
+
+    void apply(double dt, Particle_system &p)
+    {
+        if (m_nodeCount == 0) return;
+        const size_t endId = p.m_highWater;
+        const BhNode *nodes = m_nodes;
+        const unsigned int *keys = m_keys;
+        const unsigned int *values = m_values;
+        const float *bounds = m_bounds;
+        const float theta2 = m_theta * m_theta;
+        const float eps2 = m_softening * m_softening;
+        const float mass = m_particleMass;
+        const float gdt = m_G * (float)dt;
+        const unsigned int leafSize = m_leafSize;
+        Particle *buf_acc = p.m_particle;
+        const unsigned char *alive_acc = p.m_alive;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if (alive_acc[idx] == 0) return;
+                const sycl::vec<float, 4> pos = buf_acc[idx].pos;
+                const float edge = bounds[9];
+                const unsigned int self = bh_key(pos, bounds);
+                sycl::vec<float, 4> a(0.0f);
+                auto pull = [&](sycl::vec<float, 4> at, float m){
+                    sycl::vec<float, 4> d(at.x() - pos.x(), at.y() - pos.y(), at.z() - pos.z(), 0.0f);
+                    float r2 = sycl::dot(d, d) + eps2;
+                    a += d * (m / (r2 * sycl::sqrt(r2)));
+                };
+                unsigned int stack[BH_STACK];
+                unsigned int sp = 0;
+                stack[sp++] = 0; // the root, all live particles share the empty prefix
+                while (sp > 0)
+                {
+                    const BhNode &node = nodes[stack[--sp]];
+                    if (node.count <= leafSize || node.childCount == 0)
+                    {
+                        for (unsigned int i = node.start; i < node.start + node.count; ++i)
+                        {
+                            unsigned int j = values[i];
+                            if (j != idx) pull(buf_acc[j].pos, mass);
+                        }
+                        continue;
+                    }
+                    float size = edge / (float)(1u << node.level);
+                    sycl::vec<float, 4> d(node.com.x() - pos.x(), node.com.y() - pos.y(), node.com.z() - pos.z(), 0.0f);
+                    float r2 = sycl::dot(d, d);
+                    const unsigned int shift = 3 * (BH_DEPTH - node.level);
+                    const bool inside = (keys[node.start] >> shift) == (self >> shift);
+                    if (!inside && size * size < theta2 * r2)
+                    {
+                        pull(node.com, node.com.w());
+                        continue;
+                    }
+                    // no room left on the stack: the whole node, less the particle itself
+                    if (sp + node.childCount > BH_STACK)
+                    {
+                        float m = node.com.w() - (inside ? mass : 0.0f);
+                        if (m > 0.0f)
+                            pull(inside ? (node.com * node.com.w() - pos * mass) / m : node.com, m);
+                        continue;
+                    }
+                    for (unsigned int c = 0; c < node.childCount; ++c)
+                        stack[sp++] = node.firstChild + c;
+                }
+                buf_acc[idx].vel += gdt * a;
+            });
+        }).wait();
+    }
+
+private:
+    // node storage grows by copying, the levels are appended one by one
+    void reserve(size_t count)
+    {
+        if (count <= m_nodeCapacity) return;
+        size_t capacity = std::max(count, m_nodeCapacity * 2);
+        BhNode *nodes = sycl::malloc_device<BhNode>(capacity, q);
+        if (m_nodes)
+        {
+            q.memcpy(nodes, m_nodes, sizeof(BhNode) * m_nodeCapacity).wait();
+            sycl::free(m_nodes, q);
+        }
+        m_nodes = nodes;
+        m_nodeCapacity = capacity;
+    }
+
+    void release()
+    {
+        unsigned int **bufs[] = { &m_keys, &m_values, &m_tmpKeys, &m_tmpValues, &m_hist, &m_scratch, &m_flags, &m_nodeIdx };
+        for (unsigned int **b : bufs)
+        {
+            if (*b) sycl::free(*b, q);
+            *b = nullptr;
+        }
+        m_capacity = 0;
+    }
+};
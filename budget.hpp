@@ -0,0 +1,119 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+// holds a frame time target by trading particles (and optionally render
+// resolution) for time. every stage is timed on the host around its kernels,
+// which all end with .wait(), and smoothed with an exponential moving average.
+// nothing changes while the frame time is inside target +- m_hysteresis, and
+// after each change the controller waits m_cooldownFrames before the next one
+// so the averages see the effect of the last decision.
+enum BudgetStage : unsigned int
+{
+    STAGE_RENDER,
+    STAGE_UPDATE,
+    STAGE_EMIT,
+    STAGE_COUNT,
+};
+
+class BudgetController
+{
+public:
+    double m_targetMs{ 16.6 };
+    double m_hysteresis{ 0.1 }; // dead band, fraction of the target
+    double m_smoothing{ 0.1 };  // weight of the newest frame in the averages
+    int m_cooldownFrames{ 30 };
+    bool m_scaleRender{ false }; // may lower the render resolution too
+
+    // the knobs, read by the main loop
+    float m_emitScale{ 1.0f };
+    float m_renderScale{ 1.0f };
+    size_t m_particleCap{ 0 };
+
+    float m_minEmitScale{ 0.05f };
+    float m_minRenderScale{ 0.5f };
+    size_t m_maxParticles{ 0 };
+    size_t m_minParticles{ 1000 };
+
+    double m_frameMs{ 0.0 };
+    double m_stageMs[STAGE_COUNT]{};
+    std::string m_lastDecision{ "none yet" };
+private:
+    std::chrono::high_resolution_clock::time_point m_start[STAGE_COUNT];
+    int m_cooldown{ 0 };
+    bool m_primed{ false };
+public:
+    BudgetController(size_t maxParticles = 0): m_particleCap(maxParticles), m_maxParticles(maxParticles) {}
+
+    void begin(BudgetStage s)
+    {
+        m_start[s] = std::chrono::high_resolution_clock::now();
+    }
+
+    void end(BudgetStage s)
+    {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_start[s]).count();
+        m_stageMs[s] = m_primed ? m_stageMs[s] + m_smoothing * (ms - m_stageMs[s]) : ms;
+    }
+
+    // once per frame with the whole frame time, returns true if a knob moved
+    bool frame(double dt)
+    {
+        double ms = dt * 1000.0;
+        m_frameMs = m_primed ? m_frameMs + m_smoothing * (ms - m_frameMs) : ms;
+        m_primed = true;
+        if (m_cooldown > 0)
+        {
+            --m_cooldown;
+            return false;
+        }
+
+        std::ostringstream why;
+        why.precision(3);
+        if (m_frameMs > m_targetMs * (1.0 + m_hysteresis))
+        {
+            why << "frame " << m_frameMs << " ms over " << m_targetMs << " ms";
+            if (m_scaleRender && m_stageMs[STAGE_RENDER] >= m_stageMs[STAGE_UPDATE] + m_stageMs[STAGE_EMIT] && m_renderScale > m_minRenderScale)
+            {
+                m_renderScale = std::max(m_minRenderScale, m_renderScale * 0.85f);
+                why << " (render " << m_stageMs[STAGE_RENDER] << " ms), render x" << m_renderScale;
+            }
+            else if (m_emitScale > m_minEmitScale || m_particleCap > m_minParticles)
+            {
+                m_emitScale = std::max(m_minEmitScale, m_emitScale * 0.8f);
+                m_particleCap = std::max(m_minParticles, (size_t)(m_particleCap * 0.85));
+                why << " (update " << m_stageMs[STAGE_UPDATE] << " ms, emit " << m_stageMs[STAGE_EMIT] << " ms), emission x" << m_emitScale << ", cap " << m_particleCap;
+            }
+            else
+                return false; // nothing left to give
+        }
+        else if (m_frameMs < m_targetMs * (1.0 - m_hysteresis))
+        {
+            why << "frame " << m_frameMs << " ms under " << m_targetMs << " ms";
+            // resolution comes back first, it was the last thing taken
+            if (m_renderScale < 1.0f)
+            {
+                m_renderScale = std::min(1.0f, m_renderScale * 1.1f);
+                why << ", render x" << m_renderScale;
+            }
+            else if (m_emitScale < 1.0f || m_particleCap < m_maxParticles)
+            {
+                m_emitScale = std::min(1.0f, m_emitScale * 1.1f);
+                m_particleCap = std::min(m_maxParticles, (size_t)(m_particleCap * 1.1) + 1);
+                why << ", emission x" << m_emitScale << ", cap " << m_particleCap;
+            }
+            else
+                return false; // already at full quality
+        }
+        else
+            return false;
+
+        m_cooldown = m_cooldownFrames;
+        m_lastDecision = why.str();
+        std::cout << "budget: " << m_lastDecision << "\n";
+        return true;
+    }
+};
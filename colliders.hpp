@@ -0,0 +1,315 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <cmath>
+#include <limits>
+#include "particle.hpp"
+
+// analytic colliders in one device list, all tested in a single pass over the
+// particles. a work-group first reduces the bounding box of its particles,
+// then walks the list a chunk of COLLIDER_CHUNK at a time: each work-item
+// tests one collider's box against the group's, the hits are compacted into
+// local memory with a group scan and only those are tested per particle. a
+// scene of many small colliders (umbrellas, awnings, characters) costs about
+// what the few near each group cost.
+// a particle found inside a collider is pushed out to the surface, the normal
+// part of its velocity is reflected with bounce (0 sticks, 1 is elastic) and
+// the tangential part loses friction of itself. fast particles can tunnel
+// through thin colliders, there is no sweep.
+
+const size_t COLLIDER_CHUNK = 256; // also the work-group size
+
+enum ColliderType : unsigned int
+{
+    COLLIDER_PLANE,   // a: normal, w offset, solid where dot(n, p) < offset
+    COLLIDER_SPHERE,  // a: center, w radius
+    COLLIDER_BOX,     // a: center, b: half extents, c: rotation quaternion (xyz, w)
+    COLLIDER_CAPSULE, // a: first end, w radius, b: second end
+};
+
+class Collider
+{
+public:
+    sycl::vec<float, 4> a;
+    sycl::vec<float, 4> b;
+    sycl::vec<float, 4> c;
+    sycl::vec<float, 4> lo; // world bounds, filled by ColliderSet
+    sycl::vec<float, 4> hi;
+    unsigned int type;
+    float bounce;
+    float friction;
+    float pad;
+};
+
+inline sycl::vec<float, 4> quat_rotate(const sycl::vec<float, 4> &q, const sycl::vec<float, 4> &v)
+{
+    sycl::vec<float, 3> u(q.x(), q.y(), q.z());
+    sycl::vec<float, 3> w(v.x(), v.y(), v.z());
+    sycl::vec<float, 3> t = 2.0f * sycl::cross(u, w);
+    sycl::vec<float, 3> r = w + q.w() * t + sycl::cross(u, t);
+    return sycl::vec<float, 4>(r.x(), r.y(), r.z(), 0.0f);
+}
+
+inline sycl::vec<float, 4> quat_axis_angle(sycl::vec<float, 4> axis, float angle)
+{
+    axis.w() = 0.0f;
+    float len = std::sqrt(axis.x() * axis.x() + axis.y() * axis.y() + axis.z() * axis.z());
+    sycl::vec<float, 4> q = axis * (std::sin(angle * 0.5f) / len);
+    q.w() = std::cos(angle * 0.5f);
+    return q;
+}
+
+// signed distance of pos to the collider's surface, negative inside, and the
+// outward normal at the closest point
+inline float collider_distance(const Collider &col, const sycl::vec<float, 4> &pos, sycl::vec<float, 4> &normal)
+{
+    const sycl::vec<float, 4> up(0.0f, -1.0f, 0.0f, 0.0f); // for the degenerate cases, +y is down
+    switch (col.type)
+    {
+    case COLLIDER_PLANE:
+    {
+        normal = sycl::vec<float, 4>(col.a.x(), col.a.y(), col.a.z(), 0.0f);
+        return sycl::dot(normal, pos) - col.a.w();
+    }
+    case COLLIDER_CAPSULE:
+    case COLLIDER_SPHERE:
+    {
+        sycl::vec<float, 4> center = col.a;
+        if (col.type == COLLIDER_CAPSULE)
+        {
+            sycl::vec<float, 4> seg = col.b - col.a;
+            seg.w() = 0.0f;
+            sycl::vec<float, 4> rel = pos - col.a;
+            rel.w() = 0.0f;
+            float len2 = sycl::dot(seg, seg);
+            float t = len2 > 0.0f ? sycl::clamp(sycl::dot(rel, seg) / len2, 0.0f, 1.0f) : 0.0f;
+            center = col.a + seg * t;
+        }
+        sycl::vec<float, 4> off = pos - center;
+        off.w() = 0.0f;
+        float len = sycl::length(off);
+        normal = len > 1e-6f ? off / len : up;
+        return len - col.a.w();
+    }
+    case COLLIDER_BOX:
+    {
+        sycl::vec<float, 4> rel = pos - col.a;
+        rel.w() = 0.0f;
+        const sycl::vec<float, 4> conj(-col.c.x(), -col.c.y(), -col.c.z(), col.c.w());
+        sycl::vec<float, 4> local = quat_rotate(conj, rel);
+        sycl::vec<float, 4> d = sycl::fabs(local) - col.b;
+        d.w() = -1e30f;
+        sycl::vec<float, 4> n(0.0f);
+        float dist;
+        if (d.x() > 0.0f || d.y() > 0.0f || d.z() > 0.0f)
+        {
+            sycl::vec<float, 4> out = sycl::max(d, sycl::vec<float, 4>(0.0f));
+            dist = sycl::length(out);
+            for (int a = 0; a < 3; ++a)
+                n[a] = (local[a] < 0.0f ? -out[a] : out[a]) / dist;
+        }
+        else
+        {
+            // inside, out through the nearest face
+            int axis = d.x() > d.y() ? (d.x() > d.z() ? 0 : 2) : (d.y() > d.z() ? 1 : 2);
+            dist = d[axis];
+            n[axis] = local[axis] < 0.0f ? -1.0f : 1.0f;
+        }
+        normal = quat_rotate(col.c, n);
+        return dist;
+    }
+    }
+    normal = up;
+    return 1.0f;
+}
+
+class ColliderSet
+{
+public:
+    std::vector<Collider> m_colliders; // host copy, edit then call upload()
+    sycl::queue q;
+private:
+    Collider *m_devColliders{ nullptr };
+    size_t m_count{ 0 };
+    size_t m_capacity{ 0 };
+    bool m_dirty{ false };
+public:
+    ColliderSet(): q(sycl::gpu_selector_v) {}
+    ColliderSet(const ColliderSet &) = delete;
+    ColliderSet &operator=(const ColliderSet &) = delete;
+    ~ColliderSet()
+    {
+        if (m_devColliders) sycl::free(m_devColliders, q);
+    }
+
+    size_t size() const { return m_colliders.size(); }
+
+    // the particles stay on the side the normal points to
+    void add_plane(sycl::vec<float, 4> normal, float offset, float bounce, float friction)
+    {
+        normal.w() = 0.0f;
+        normal /= std::sqrt(normal.x() * normal.x() + normal.y() * normal.y() + normal.z() * normal.z());
+        normal.w() = offset;
+        add(COLLIDER_PLANE, normal, sycl::vec<float, 4>(0.0f), sycl::vec<float, 4>(0.0f), bounce, friction);
+    }
+
+    void add_sphere(sycl::vec<float, 4> center, float radius, float bounce, float friction)
+    {
+        center.w() = radius;
+        add(COLLIDER_SPHERE, center, sycl::vec<float, 4>(0.0f), sycl::vec<float, 4>(0.0f), bounce, friction);
+    }
+
+    // rotation is a unit quaternion, see quat_axis_angle()
+    void add_box(const sycl::vec<float, 4> &center, const sycl::vec<float, 4> &halfExtents, const sycl::vec<float, 4> &rotation, float bounce, float friction)
+    {
+        add(COLLIDER_BOX, center, halfExtents, rotation, bounce, friction);
+    }
+
+    void add_capsule(sycl::vec<float, 4> from, const sycl::vec<float, 4> &to, float radius, float bounce, float friction)
+    {
+        from.w() = radius;
+        add(COLLIDER_CAPSULE, from, to, sycl::vec<float, 4>(0.0f), bounce, friction);
+    }
+
+    // recomputes the bounds, call after moving colliders in m_colliders
+    void upload()
+    {
+        for (Collider &col : m_colliders)
+            bounds(col);
+        m_count = m_colliders.size();
+        m_dirty = false;
+        if (m_count > m_capacity)
+        {
+            if (m_devColliders) sycl::free(m_devColliders, q);
+            m_capacity = m_count;
+            m_devColliders = sycl::malloc_device<Collider>(m_capacity, q);
+        }
+        if (m_count == 0) return;
+        q.memcpy(m_devColliders, m_colliders.data(), sizeof(Collider) * m_count).wait();
+    }
+
+    void apply(Particle_system &p)
+    {
+        if (m_dirty) upload();
+        if (m_count == 0 || p.m_highWater == 0) return;
+        const size_t endId = p.m_highWater;
+        const size_t count = m_count;
+        const Collider *colliders = m_devColliders;
+        Particle *buf_acc = p.m_particle;
+        const unsigned char *alive_acc = p.m_alive;
+        const float inf = std::numeric_limits<float>::infinity();
+        const size_t global = (endId + COLLIDER_CHUNK - 1) / COLLIDER_CHUNK * COLLIDER_CHUNK;
+        q.submit([&](sycl::handler &h){
+            sycl::local_accessor<Collider, 1> list(sycl::range<1>(COLLIDER_CHUNK), h);
+            h.parallel_for(sycl::nd_range<1>(global, COLLIDER_CHUNK), [=](sycl::nd_item<1> it){
+                size_t idx = it.get_global_id(0);
+                size_t lid = it.get_local_id(0);
+                auto g = it.get_group();
+                // no early return, the whole group culls together
+                bool live = idx < endId && alive_acc[idx] != 0;
+                sycl::vec<float, 4> pos = live ? buf_acc[idx].pos : sycl::vec<float, 4>(0.0f);
+                sycl::vec<float, 4> vel = live ? buf_acc[idx].vel : sycl::vec<float, 4>(0.0f);
+                float lo[3], hi[3];
+                for (int a = 0; a < 3; ++a)
+                {
+                    lo[a] = sycl::reduce_over_group(g, live ? pos[a] : inf, sycl::minimum<float>());
+                    hi[a] = sycl::reduce_over_group(g, live ? pos[a] : -inf, sycl::maximum<float>());
+                }
+                bool touched = false;
+                for (size_t base = 0; base < count; base += COLLIDER_CHUNK)
+                {
+                    bool overlap = false;
+                    Collider mine;
+                    if (base + lid < count)
+                    {
+                        mine = colliders[base + lid];
+                        overlap = mine.lo.x() <= hi[0] && mine.hi.x() >= lo[0]
+                               && mine.lo.y() <= hi[1] && mine.hi.y() >= lo[1]
+                               && mine.lo.z() <= hi[2] && mine.hi.z() >= lo[2];
+                    }
+                    unsigned int slot = sycl::exclusive_scan_over_group(g, overlap ? 1u : 0u, sycl::plus<unsigned int>());
+                    unsigned int hits = sycl::reduce_over_group(g, overlap ? 1u : 0u, sycl::plus<unsigned int>());
+                    if (overlap)
+                        list[slot] = mine;
+                    sycl::group_barrier(g);
+                    if (live)
+                    {
+                        for (unsigned int c = 0; c < hits; ++c)
+                        {
+                            const Collider &col = list[c];
+                            sycl::vec<float, 4> n;
+                            float d = collider_distance(col, pos, n);
+                            if (d >= 0.0f) continue;
+                            pos -= n * d;
+                            float vn = sycl::dot(vel, n);
+                            if (vn < 0.0f)
+                            {
+                                sycl::vec<float, 4> normalVel = n * vn;
+                                vel = (vel - normalVel) * (1.0f - col.friction) - normalVel * col.bounce;
+                            }
+                            touched = true;
+                        }
+                    }
+                    sycl::group_barrier(g);
+                }
+                if (touched)
+                {
+                    pos.w() = buf_acc[idx].pos.w();
+                    vel.w() = buf_acc[idx].vel.w();
+                    buf_acc[idx].pos = pos;
+                    buf_acc[idx].vel = vel;
+                }
+            });
+        }).wait();
+    }
+
+private:
+    void add(ColliderType type, const sycl::vec<float, 4> &a, const sycl::vec<float, 4> &b, const sycl::vec<float, 4> &c, float bounce, float friction)
+    {
+        Collider col;
+        col.a = a;
+        col.b = b;
+        col.c = c;
+        col.type = type;
+        col.bounce = bounce;
+        col.friction = friction;
+        col.pad = 0.0f;
+        m_colliders.push_back(col);
+        m_dirty = true;
+    }
+
+    static void bounds(Collider &col)
+    {
+        const float big = std::numeric_limits<float>::max();
+        switch (col.type)
+        {
+        case COLLIDER_PLANE:
+            col.lo = sycl::vec<float, 4>(-big);
+            col.hi = sycl::vec<float, 4>(big);
+            break;
+        case COLLIDER_SPHERE:
+            col.lo = col.a - sycl::vec<float, 4>(col.a.w());
+            col.hi = col.a + sycl::vec<float, 4>(col.a.w());
+            break;
+        case COLLIDER_CAPSULE:
+            col.lo = sycl::min(col.a, col.b) - sycl::vec<float, 4>(col.a.w());
+            col.hi = sycl::max(col.a, col.b) + sycl::vec<float, 4>(col.a.w());
+            break;
+        case COLLIDER_BOX:
+        {
+            // extent along each world axis of the rotated box
+            sycl::vec<float, 4> ext(0.0f);
+            for (int a = 0; a < 3; ++a)
+            {
+                sycl::vec<float, 4> axis(0.0f);
+                axis[a] = col.b[a];
+                sycl::vec<float, 4> r = quat_rotate(col.c, axis);
+                ext += sycl::fabs(r);
+            }
+            col.lo = col.a - ext;
+            col.hi = col.a + ext;
+            break;
+        }
+        }
+    }
+};
@@ -0,0 +1,172 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <cmath>
+#include "my_random.hpp"
+#include "rng_stream.hpp"
+
+// turbulence from a divergence free field, baked once instead of evaluating
+// noise gradients per particle per frame. bake():
+//  - three independent periodic gradient noises (the vector potential), the
+//    lattice gradients are philox keyed by (seed, lattice point, octave,
+//    STREAM_CURL) and wrap around the volume so it tiles
+//  - their curl with central differences, wrapping as well, which keeps the
+//    discrete divergence at zero
+//  - scaled so the rms speed of the volume is 1
+// the update kernel does one trilinear, wrapping lookup per particle. the
+// volume covers m_tileSize world units and repeats, scrolling with m_scroll.
+
+// device side, copy it into a kernel
+class CurlView
+{
+public:
+    const sycl::vec<float, 4> *m_vel{ nullptr };
+    unsigned int m_res{ 0 };
+    float m_tileSize{ 1.0f };
+    sycl::vec<float, 4> m_scroll{ 0.0f }; // world units per second
+    float m_strength{ 0.0f };             // acceleration for an rms sample
+
+    bool valid() const { return m_vel != nullptr; }
+
+    sycl::vec<float, 4> sample(const sycl::vec<float, 4> &pos, float time) const
+    {
+        const float toGrid = (float)m_res / m_tileSize;
+        float fx = (pos.x() - m_scroll.x() * time) * toGrid;
+        float fy = (pos.y() - m_scroll.y() * time) * toGrid;
+        float fz = (pos.z() - m_scroll.z() * time) * toGrid;
+        float x0 = sycl::floor(fx), y0 = sycl::floor(fy), z0 = sycl::floor(fz);
+        float tx = fx - x0, ty = fy - y0, tz = fz - z0;
+        const unsigned int mask = m_res - 1; // res is a power of two, & wraps negatives too
+        unsigned int i = (unsigned int)(int)x0 & mask, j = (unsigned int)(int)y0 & mask, k = (unsigned int)(int)z0 & mask;
+        unsigned int i1 = (i + 1) & mask, j1 = (j + 1) & mask, k1 = (k + 1) & mask;
+        auto at = [&](unsigned int a, unsigned int b, unsigned int c){ return m_vel[((size_t)c * m_res + b) * m_res + a]; };
+        sycl::vec<float, 4> c00 = sycl::mix(at(i, j, k), at(i1, j, k), sycl::vec<float, 4>(tx));
+        sycl::vec<float, 4> c10 = sycl::mix(at(i, j1, k), at(i1, j1, k), sycl::vec<float, 4>(tx));
+        sycl::vec<float, 4> c01 = sycl::mix(at(i, j, k1), at(i1, j, k1), sycl::vec<float, 4>(tx));
+        sycl::vec<float, 4> c11 = sycl::mix(at(i, j1, k1), at(i1, j1, k1), sycl::vec<float, 4>(tx));
+        sycl::vec<float, 4> c0 = sycl::mix(c00, c10, sycl::vec<float, 4>(ty));
+        sycl::vec<float, 4> c1 = sycl::mix(c01, c11, sycl::vec<float, 4>(ty));
+        return sycl::mix(c0, c1, sycl::vec<float, 4>(tz)) * m_strength;
+    }
+};
+
+class CurlNoiseVolume
+{
+public:
+    unsigned int m_period{ 4 };   // noise cells across the volume for the first octave
+    unsigned int m_octaves{ 2 };  // each one twice the frequency, half the amplitude
+    float m_tileSize{ 800.0f };
+    sycl::vec<float, 4> m_scroll{ 20.0f, -10.0f, 0.0f, 0.0f };
+    float m_strength{ 60.0f };
+    unsigned long long m_seed{ 0 };
+    sycl::queue q;
+private:
+    unsigned int m_res;
+    sycl::vec<float, 4> *m_vel{ nullptr };
+public:
+    // res is rounded up to a power of two
+    CurlNoiseVolume(unsigned int res = 64): q(sycl::gpu_selector_v)
+    {
+        m_res = 4;
+        while (m_res < res) m_res <<= 1;
+        m_vel = sycl::malloc_device<sycl::vec<float, 4>>((size_t)m_res * m_res * m_res, q);
+    }
+    CurlNoiseVolume(const CurlNoiseVolume &) = delete;
+    CurlNoiseVolume &operator=(const CurlNoiseVolume &) = delete;
+    ~CurlNoiseVolume()
+    {
+        sycl::free(m_vel, q);
+    }
+
+    CurlView view() const
+    {
+        return CurlView{ m_vel, m_res, m_tileSize, m_scroll, m_strength };
+    }
+
+    // periodic gradient noise at lattice coordinates p, period cells per tile
+    static float noise(unsigned long long seed, sycl::vec<float, 4> p, unsigned int period, unsigned int channel)
+    {
+        float x0 = sycl::floor(p.x()), y0 = sycl::floor(p.y()), z0 = sycl::floor(p.z());
+        float fx = p.x() - x0, fy = p.y() - y0, fz = p.z() - z0;
+        // quintic fade, smooth enough for the curl's derivatives
+        float ux = fx * fx * fx * (fx * (fx * 6.0f - 15.0f) + 10.0f);
+        float uy = fy * fy * fy * (fy * (fy * 6.0f - 15.0f) + 10.0f);
+        float uz = fz * fz * fz * (fz * (fz * 6.0f - 15.0f) + 10.0f);
+        float corners[8];
+        for (int c = 0; c < 8; ++c)
+        {
+            int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+            unsigned int i = ((unsigned int)(int)x0 + dx) % period;
+            unsigned int j = ((unsigned int)(int)y0 + dy) % period;
+            unsigned int k = ((unsigned int)(int)z0 + dz) % period;
+            unsigned long long lattice = ((unsigned long long)k * period + j) * period + i;
+            sycl::vec<float, 4> g = sphere_from_uniform(philox_randf(seed, lattice, channel, STREAM_CURL));
+            corners[c] = g.x() * (fx - dx) + g.y() * (fy - dy) + g.z() * (fz - dz);
+        }
+        float a = corners[0] + (corners[1] - corners[0]) * ux;
+        float b = corners[2] + (corners[3] - corners[2]) * ux;
+        float c = corners[4] + (corners[5] - corners[4]) * ux;
+        float d = corners[6] + (corners[7] - corners[6]) * ux;
+        float e = a + (b - a) * uy;
+        float f = c + (d - c) * uy;
+        return e + (f - e) * uz;
+    }
+
+    void bake()
+    {
+        const unsigned int res = m_res;
+        const size_t cells = (size_t)res * res * res;
+        const unsigned long long seed = m_seed;
+        const unsigned int period = m_period;
+        const unsigned int octaves = m_octaves;
+        sycl::vec<float, 4> *potential = sycl::malloc_device<sycl::vec<float, 4>>(cells, q);
+        sycl::vec<float, 4> *vel = m_vel;
+
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(cells), [=](sycl::id<1> idx_d){
+                size_t n = idx_d.get(0);
+                sycl::vec<float, 4> cell((float)(n % res), (float)((n / res) % res), (float)(n / ((size_t)res * res)), 0.0f);
+                sycl::vec<float, 4> psi(0.0f);
+                float amplitude = 1.0f;
+                unsigned int p = period;
+                for (unsigned int o = 0; o < octaves; ++o)
+                {
+                    sycl::vec<float, 4> at = cell * ((float)p / (float)res);
+                    // three potentials from three channels per octave
+                    psi.x() += amplitude * noise(seed, at, p, o * 3 + 0);
+                    psi.y() += amplitude * noise(seed, at, p, o * 3 + 1);
+                    psi.z() += amplitude * noise(seed, at, p, o * 3 + 2);
+                    amplitude *= 0.5f;
+                    p *= 2;
+                }
+                potential[n] = psi;
+            });
+        }).wait();
+
+        const unsigned int mask = res - 1;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(cells), [=](sycl::id<1> idx_d){
+                size_t n = idx_d.get(0);
+                unsigned int i = (unsigned int)(n % res), j = (unsigned int)((n / res) % res), k = (unsigned int)(n / ((size_t)res * res));
+                auto at = [&](unsigned int a, unsigned int b, unsigned int c){ return potential[((size_t)(c & mask) * res + (b & mask)) * res + (a & mask)]; };
+                // (d/dy psi.z - d/dz psi.y, d/dz psi.x - d/dx psi.z, d/dx psi.y - d/dy psi.x), grid units
+                sycl::vec<float, 4> dx = (at(i + 1, j, k) - at(i + mask, j, k)) * 0.5f;
+                sycl::vec<float, 4> dy = (at(i, j + 1, k) - at(i, j + mask, k)) * 0.5f;
+                sycl::vec<float, 4> dz = (at(i, j, k + 1) - at(i, j, k + mask)) * 0.5f;
+                vel[n] = sycl::vec<float, 4>(dy.z() - dz.y(), dz.x() - dx.z(), dx.y() - dy.x(), 0.0f);
+            });
+        }).wait();
+        sycl::free(potential, q);
+
+        // rms speed 1, done once on the host
+        std::vector<sycl::vec<float, 4>> host(cells);
+        q.memcpy(host.data(), m_vel, sizeof(sycl::vec<float, 4>) * cells).wait();
+        double sum = 0.0;
+        for (const sycl::vec<float, 4> &v : host)
+            sum += (double)v.x() * v.x() + (double)v.y() * v.y() + (double)v.z() * v.z();
+        float scale = sum > 0.0 ? (float)(1.0 / std::sqrt(sum / (double)cells)) : 0.0f;
+        for (sycl::vec<float, 4> &v : host)
+            v *= scale;
+        q.memcpy(m_vel, host.data(), sizeof(sycl::vec<float, 4>) * cells).wait();
+    }
+};
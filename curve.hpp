@@ -0,0 +1,129 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+
+// keyframed parameter curves. all keys of all curves sit in one small device
+// buffer uploaded once, kernels evaluate them from the simulation time so an
+// animated effect needs no per-frame parameter push from the host.
+
+enum CurveInterp : unsigned int
+{
+    CURVE_LINEAR,
+    CURVE_CUBIC, // catmull-rom like hermite, tangents from the neighbour keys
+};
+
+class CurveKey
+{
+public:
+    sycl::vec<float, 4> value;
+    float t;
+};
+
+// device side view of one curve, an empty curve (m_count == 0) is "not set"
+class Curve
+{
+public:
+    const CurveKey *m_keys{ nullptr };
+    unsigned int m_count{ 0 };
+    unsigned int m_interp{ CURVE_LINEAR };
+    bool m_loop{ false }; // repeat the key range forever instead of holding the ends
+
+    bool valid() const { return m_count > 0; }
+
+    sycl::vec<float, 4> eval(float t) const
+    {
+        const CurveKey *k = m_keys;
+        unsigned int n = m_count;
+        float first = k[0].t;
+        float last = k[n - 1].t;
+        if (m_loop && last > first)
+        {
+            t = first + sycl::fmod(t - first, last - first);
+            if (t < first) t += last - first;
+        }
+        if (n == 1 || t <= first) return k[0].value;
+        if (t >= last) return k[n - 1].value;
+
+        // segment lo with k[lo].t <= t < k[lo + 1].t
+        unsigned int lo = 0, hi = n - 1;
+        while (lo + 1 < hi)
+        {
+            unsigned int mid = (lo + hi) / 2;
+            if (k[mid].t <= t) lo = mid;
+            else hi = mid;
+        }
+        const CurveKey &p1 = k[lo];
+        const CurveKey &p2 = k[lo + 1];
+        float span = p2.t - p1.t;
+        float s = (t - p1.t) / span;
+        if (m_interp == CURVE_LINEAR)
+            return sycl::mix(p1.value, p2.value, sycl::vec<float, 4>(s));
+
+        const CurveKey &p0 = k[lo > 0 ? lo - 1 : lo];
+        const CurveKey &p3 = k[lo + 2 < n ? lo + 2 : lo + 1];
+        sycl::vec<float, 4> m1 = (p2.value - p0.value) * (span / (p2.t - p0.t));
+        sycl::vec<float, 4> m2 = (p3.value - p1.value) * (span / (p3.t - p1.t));
+        float s2 = s * s;
+        float s3 = s2 * s;
+        return (2.0f * s3 - 3.0f * s2 + 1.0f) * p1.value + (s3 - 2.0f * s2 + s) * m1
+             + (-2.0f * s3 + 3.0f * s2) * p2.value + (s3 - s2) * m2;
+    }
+};
+
+// owns the device buffer, add() every curve, upload() once, then hand get()
+// views to the spawn components and updaters
+class CurveBank
+{
+public:
+    std::vector<CurveKey> m_keys;
+    std::vector<Curve> m_curves; // m_keys is filled in by get()
+    std::vector<size_t> m_offsets; // first key of every curve
+    CurveKey *m_devKeys{ nullptr };
+    sycl::queue q;
+public:
+    CurveBank(): q(sycl::gpu_selector_v) {}
+    CurveBank(const CurveBank &) = delete;
+    CurveBank &operator=(const CurveBank &) = delete;
+    ~CurveBank()
+    {
+        if (m_devKeys) sycl::free(m_devKeys, q);
+    }
+
+    // keys may come in any order, times must be distinct
+    size_t add(std::vector<CurveKey> keys, CurveInterp interp, bool loop = false)
+    {
+        // a handful of keys, insertion sort (std::sort would trip over the global swap of particle.hpp)
+        for (size_t i = 1; i < keys.size(); ++i)
+        {
+            CurveKey key = keys[i];
+            size_t j = i;
+            for (; j > 0 && keys[j - 1].t > key.t; --j)
+                keys[j] = keys[j - 1];
+            keys[j] = key;
+        }
+        Curve c;
+        c.m_count = keys.size();
+        c.m_interp = interp;
+        c.m_loop = loop;
+        m_offsets.push_back(m_keys.size());
+        m_keys.insert(m_keys.end(), keys.begin(), keys.end());
+        m_curves.push_back(c);
+        return m_curves.size() - 1;
+    }
+
+    void upload()
+    {
+        if (m_devKeys) sycl::free(m_devKeys, q);
+        m_devKeys = nullptr;
+        if (m_keys.empty()) return;
+        m_devKeys = sycl::malloc_device<CurveKey>(m_keys.size(), q);
+        q.memcpy(m_devKeys, m_keys.data(), sizeof(CurveKey) * m_keys.size()).wait();
+    }
+
+    Curve get(size_t handle) const
+    {
+        Curve c = m_curves[handle];
+        c.m_keys = m_devKeys + m_offsets[handle];
+        return c;
+    }
+};
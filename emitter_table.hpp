@@ -0,0 +1,150 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include "generator.hpp"
+
+// many emitters sharing one set of components, e.g. a whole sky of rain
+// clouds. the table lives in device memory, every frame a prefix sum over the
+// per emitter counts gives each emitter a range of spawn ranks, and a single
+// spawn kernel finds the emitter of its rank by binary search. the cost is
+// one launch whatever the number of emitters.
+template<class... Components>
+class EmitterTable
+{
+public:
+    using Params = EmitterParams<Components...>;
+
+    std::vector<Params> m_params; // host copy, edit then call upload()
+    std::vector<float> m_rates;   // particles per second of each emitter
+    float m_rateScale{ 1.0f };    // multiplies every rate, no upload needed
+    unsigned long long m_seed{ 0 };
+    unsigned int m_frame{ 0 }; // philox counter, bumped once per generate()
+    sycl::queue q;
+private:
+    Params *m_devParams{ nullptr };
+    float *m_devRates{ nullptr };
+    float *m_carry{ nullptr };   // fractional particles left over from previous frames
+    size_t *m_offsets{ nullptr }; // exclusive prefix sum of this frame's counts, n + 1 entries
+    size_t *m_counter{ nullptr };
+    size_t m_capacity{ 0 };
+    bool m_dirty{ false };
+
+    static constexpr size_t SCAN_GROUP = 256;
+public:
+    EmitterTable(): q(sycl::gpu_selector_v)
+    {
+        m_counter = sycl::malloc_device<size_t>(1, q);
+    }
+    EmitterTable(const EmitterTable &) = delete;
+    EmitterTable &operator=(const EmitterTable &) = delete;
+    ~EmitterTable()
+    {
+        release();
+        sycl::free(m_counter, q);
+    }
+
+    size_t add(const Params &params, float rate)
+    {
+        m_params.push_back(params);
+        m_rates.push_back(rate);
+        m_dirty = true;
+        return m_params.size() - 1;
+    }
+
+    size_t size() const { return m_params.size(); }
+
+    // pushes the host table to the device, the carried fractions restart at 0
+    void upload()
+    {
+        size_t n = m_params.size();
+        if (n > m_capacity)
+        {
+            release();
+            m_capacity = n;
+            m_devParams = sycl::malloc_device<Params>(n, q);
+            m_devRates = sycl::malloc_device<float>(n, q);
+            m_carry = sycl::malloc_device<float>(n, q);
+            m_offsets = sycl::malloc_device<size_t>(n + 1, q);
+        }
+        if (n > 0)
+        {
+            q.memcpy(m_devParams, m_params.data(), sizeof(Params) * n);
+            q.memcpy(m_devRates, m_rates.data(), sizeof(float) * n);
+            q.memset(m_carry, 0, sizeof(float) * n);
+            q.wait();
+        }
+        m_dirty = false;
+    }
+
+    // spawns rate * dt particles for every emitter, returns how many were spawned
+    size_t generate(Particle_system &p, double dt)
+    {
+        if (m_dirty) upload();
+        const size_t n = m_params.size();
+        if (n == 0) return 0;
+
+        const float localDT = (float)dt;
+        const float rateScale = m_rateScale;
+        float *rates = m_devRates;
+        float *carry = m_carry;
+        size_t *offsets = m_offsets;
+
+        // per emitter count and exclusive scan, one work-group walking the table
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::nd_range<1>(SCAN_GROUP, SCAN_GROUP), [=](sycl::nd_item<1> it){
+                auto g = it.get_group();
+                size_t lid = it.get_local_id(0);
+                size_t running = 0;
+                for (size_t base = 0; base < n; base += SCAN_GROUP)
+                {
+                    size_t i = base + lid;
+                    size_t c = 0;
+                    if (i < n)
+                    {
+                        float want = rates[i] * rateScale * localDT + carry[i];
+                        c = (size_t)sycl::floor(want);
+                        carry[i] = want - (float)c;
+                    }
+                    size_t s = sycl::exclusive_scan_over_group(g, c, sycl::plus<size_t>());
+                    if (i < n) offsets[i] = running + s;
+                    running += sycl::reduce_over_group(g, c, sycl::plus<size_t>());
+                }
+                if (lid == 0) offsets[n] = running;
+            });
+        }).wait();
+
+        size_t total = 0;
+        q.copy<size_t>(offsets + n, &total, 1).wait();
+
+        Params *params = m_devParams;
+        unsigned long long seed = m_seed;
+        unsigned int frame = m_frame++;
+        return spawn_slots(q, p, total, m_counter, [=](Particle &out, size_t idx, size_t rank){
+            // last emitter whose range starts at or before this rank
+            size_t lo = 0, hi = n;
+            while (lo + 1 < hi)
+            {
+                size_t mid = (lo + hi) / 2;
+                if (offsets[mid] <= rank) lo = mid;
+                else hi = mid;
+            }
+            params[lo].emit(out, SpawnCtx{ seed, idx, frame });
+        });
+    }
+
+private:
+    void release()
+    {
+        if (m_devParams) sycl::free(m_devParams, q);
+        if (m_devRates) sycl::free(m_devRates, q);
+        if (m_carry) sycl::free(m_carry, q);
+        if (m_offsets) sycl::free(m_offsets, q);
+        m_devParams = nullptr;
+        m_devRates = nullptr;
+        m_carry = nullptr;
+        m_offsets = nullptr;
+        m_capacity = 0;
+    }
+};
+
+using GenTable = EmitterTable<BoxPos, BoxVel, RangeColor, RangeTime>;
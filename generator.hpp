@@ -3,222 +3,354 @@
 #include "particle.hpp"
 // #include "random.hpp"
 #include "my_random.hpp"
+#include "curve.hpp"
 
 // using Random = effolkronium::random_static;
 
 
+// what a spawn component knows about the particle it is building
+class SpawnCtx
+{
+public:
+    unsigned long long seed;
+    size_t id; // slot being spawned
+    unsigned int frame;
+    bool lowDiscrepancy{ false };
+    unsigned int sample{ 0 }; // global emission index, drives the halton points
+    HaltonScramble scramble{};
+    float time{ 0.0f }; // simulation time, what the curve components are evaluated at
 
+    // four uniform floats in [0, 1), one philox call per stream
+    sycl::vec<float, 4> rand(unsigned int stream) const
+    {
+        return philox_randf(seed, id, frame, stream);
+    }
+
+    // like rand() but low-discrepancy when the emitter asks for it: halton
+    // dimensions dim0..dim0+2 in xyz, w stays pseudo-random
+    sycl::vec<float, 4> qrand(unsigned int dim0, unsigned int stream) const
+    {
+        sycl::vec<float, 4> u = rand(stream);
+        if (lowDiscrepancy)
+        {
+            u.x() = halton(sample, dim0, scramble);
+            u.y() = halton(sample, dim0 + 1, scramble);
+            u.z() = halton(sample, dim0 + 2, scramble);
+        }
+        return u;
+    }
+};
 
-sycl::vec<float, 4> random_vec(sycl::vec<float, 4> min, sycl::vec<float, 4> max, unsigned int time)
+// halton dimensions used by the spawn components
+enum HaltonDim : unsigned int
 {
-    return random_rangef(min, max, time);
-}
+    HALTON_POS = 0,
+    HALTON_VEL = 3,
+};
 
+// spawn components. each one fills its part of a particle that is still in
+// registers, Emitter<...> below chains them at compile time into one kernel.
 
-class Gen 
+class BoxPos
 {
 public:
-    sycl::vec<float, 4> m_pos;
-    sycl::vec<float, 4> m_maxStartPosOffset;
-    sycl::vec<float, 4> m_minStartCol{ 0.0 };
-    sycl::vec<float, 4> m_maxStartCol{ 0.0 };
-    sycl::vec<float, 4> m_minEndCol{ 0.0 };
-    sycl::vec<float, 4> m_maxEndCol{ 0.0 };
-    sycl::vec<float, 4> m_minStartVel{ 0.0 };
-    sycl::vec<float, 4> m_maxStartVel{ 0.0 };
-    float m_minTime;
-    float m_maxTime;
-    sycl::queue q;
-    size_t *rev_count_tmp;
-public:
-    Gen(): m_pos(0.0f), m_maxStartPosOffset(100.0), m_minStartCol(255.0f, 0, 0, 255.0f), m_maxStartCol(255, 150, 150, 255), m_minEndCol(0, 255.0f, 255.0f, 255.0f), m_maxEndCol(0, 255.0f, 255.0f, 255.0f), m_minStartVel(-50), m_maxStartVel(50), m_minTime(10.0f), m_maxTime(60.0f), q(sycl::gpu_selector_v) 
-    { 
-        rev_count_tmp = sycl::malloc_device<size_t>(1, q);
-        q.memset(rev_count_tmp, 0, sizeof(size_t)).wait();
-    }
+    sycl::vec<float, 4> m_pos{ 0.0f };
+    sycl::vec<float, 4> m_maxStartPosOffset{ 100.0f };
 
-    void generate(Particle_system &p, size_t rev_size)
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
     {
         sycl::vec<float, 4> posMin{ m_pos.x() - m_maxStartPosOffset.x(), m_pos.y() - m_maxStartPosOffset.y(), m_pos.z() - m_maxStartPosOffset.z(), 1.0 };
         sycl::vec<float, 4> posMax{ m_pos.x() + m_maxStartPosOffset.x(), m_pos.y() + m_maxStartPosOffset.y(), m_pos.z() + m_maxStartPosOffset.z(), 1.0 };
-        
-        // sycl::buffer<Particle, 1> buf(p.m_particle);
-        
-        // Determine number of threads to use
-        // const unsigned int numThreads = std::thread::hardware_concurrency();
-        
-        // std::vector<std::thread> threads;
-        // threads.reserve(numThreads);
-        unsigned int current_time = time(0);
-
-        q.memset(rev_count_tmp, 0, sizeof(size_t)).wait();
-
-        // Lambda function for thread work with strided access pattern
+        pt.pos = ctx.qrand(HALTON_POS, STREAM_POS) * (posMax - posMin) + posMin;
+    }
+};
+
+class RoundPos
+{
+public:
+    sycl::vec<float, 4> m_center{ 0.0f };
+    float m_radX{ 100.0f };
+    float m_radY{ 100.0f };
+
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        float ang = ctx.qrand(HALTON_POS, STREAM_POS).x() * (float)(M_PI * 2.0);
+        pt.pos = m_center + sycl::vec<float, 4>(m_radX * sycl::sin(ang), m_radY * sycl::cos(ang), 0.0f, 0.0f);
+        pt.pos.w() = 1.0f;
+    }
+};
+
+class BoxVel
+{
+public:
+    sycl::vec<float, 4> m_minStartVel{ -50.0f };
+    sycl::vec<float, 4> m_maxStartVel{ 50.0f };
+
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        pt.vel = ctx.qrand(HALTON_VEL, STREAM_VEL) * (m_maxStartVel - m_minStartVel) + m_minStartVel;
+    }
+};
+
+class SphereVel
+{
+public:
+    float m_minVel{ 0.0f };
+    float m_maxVel{ 50.0f };
+
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        sycl::vec<float, 4> u = ctx.qrand(HALTON_VEL, STREAM_VEL);
+        float phi = u.x() * (float)(M_PI * 2.0) - (float)M_PI;
+        float theta = u.y() * (float)(M_PI * 2.0) - (float)M_PI;
+        float v = u.z() * (m_maxVel - m_minVel) + m_minVel;
+        float r = v * sycl::sin(phi);
+        pt.vel = sycl::vec<float, 4>(r * sycl::cos(theta), r * sycl::sin(theta), v * sycl::cos(phi), 1.0f);
+    }
+};
+
+class RangeColor
+{
+public:
+    sycl::vec<float, 4> m_minStartCol{ 255.0f, 0.0f, 0.0f, 255.0f };
+    sycl::vec<float, 4> m_maxStartCol{ 255.0f, 150.0f, 150.0f, 255.0f };
+    sycl::vec<float, 4> m_minEndCol{ 0.0f, 255.0f, 255.0f, 255.0f };
+    sycl::vec<float, 4> m_maxEndCol{ 0.0f, 255.0f, 255.0f, 255.0f };
+
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        pt.startCol = ctx.rand(STREAM_START_COL) * (m_maxStartCol - m_minStartCol) + m_minStartCol;
+        pt.endCol = ctx.rand(STREAM_END_COL) * (m_maxEndCol - m_minEndCol) + m_minEndCol;
+        pt.col = pt.startCol;
+    }
+};
+
+class RangeTime
+{
+public:
+    float m_minTime{ 10.0f };
+    float m_maxTime{ 60.0f };
+
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        pt.time.x() = pt.time.y() = ctx.rand(STREAM_TIME).x() * (m_maxTime - m_minTime) + m_minTime;
+        pt.time.z() = (float)0.0;
+        pt.time.w() = (float)1.0 / pt.time.x();
+    }
+};
+
+// keyframed versions of RangeColor / RangeTime, the ranges follow curves of
+// the simulation time. an unset curve keeps the constant of the plain component.
+class CurveColor : public RangeColor
+{
+public:
+    Curve m_minStartColCurve;
+    Curve m_maxStartColCurve;
+    Curve m_minEndColCurve;
+    Curve m_maxEndColCurve;
+
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        sycl::vec<float, 4> minStart = m_minStartColCurve.valid() ? m_minStartColCurve.eval(ctx.time) : m_minStartCol;
+        sycl::vec<float, 4> maxStart = m_maxStartColCurve.valid() ? m_maxStartColCurve.eval(ctx.time) : m_maxStartCol;
+        sycl::vec<float, 4> minEnd = m_minEndColCurve.valid() ? m_minEndColCurve.eval(ctx.time) : m_minEndCol;
+        sycl::vec<float, 4> maxEnd = m_maxEndColCurve.valid() ? m_maxEndColCurve.eval(ctx.time) : m_maxEndCol;
+        pt.startCol = ctx.rand(STREAM_START_COL) * (maxStart - minStart) + minStart;
+        pt.endCol = ctx.rand(STREAM_END_COL) * (maxEnd - minEnd) + minEnd;
+        pt.col = pt.startCol;
+    }
+};
+
+class CurveTime : public RangeTime
+{
+public:
+    Curve m_timeCurve; // .x is min, .y is max life time
+
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        float minTime = m_minTime, maxTime = m_maxTime;
+        if (m_timeCurve.valid())
+        {
+            sycl::vec<float, 4> range = m_timeCurve.eval(ctx.time);
+            minTime = range.x();
+            maxTime = range.y();
+        }
+        pt.time.x() = pt.time.y() = ctx.rand(STREAM_TIME).x() * (maxTime - minTime) + minTime;
+        pt.time.z() = (float)0.0;
+        pt.time.w() = (float)1.0 / pt.time.x();
+    }
+};
+
+// a particle in registers for spawn() to fill, acc and col cleared
+template<class Spawn>
+Particle fresh_particle(const Spawn &spawn, size_t idx, size_t rank)
+{
+    Particle pt;
+    pt.col = sycl::vec<float, 4>(0.0f);
+    pt.acc = sycl::vec<float, 4>(0.0f);
+    spawn(pt, idx, rank);
+    return pt;
+}
+
+// hands out `count` slots of the pool and calls spawn(particle, slot, rank)
+// on each of them, rank being 0..count-1. dead slots below the high-water mark
+// are recycled first, fresh slots are only touched for what is left.
+// spawn gets a particle in registers with acc and col cleared (the slot may
+// hold garbage or an old particle), it is stored to the slot once.
+// returns how many slots were actually spawned (the pool may be full).
+template<class Spawn>
+size_t spawn_slots(sycl::queue &q, Particle_system &p, size_t count, size_t *counter, Spawn spawn)
+{
+    size_t reused = 0;
+    if (count == 0) return 0;
+    if (p.m_highWater > 0)
+    {
+        q.memset(counter, 0, sizeof(size_t)).wait();
         q.submit([&](sycl::handler &h){
             auto buf_acc = p.m_particle;
-            auto m_minStartCol = this->m_minStartCol;
-            auto m_maxStartCol = this->m_maxStartCol;
-            auto m_minEndCol = this->m_minEndCol;
-            auto m_maxEndCol = this->m_maxEndCol;
-            auto m_minStartVel = this->m_minStartVel;
-            auto m_maxStartVel = this->m_maxStartVel;
-            auto m_minTime = this->m_minTime;
-            auto m_maxTime = this->m_maxTime;
-            size_t size_all = p.size;
-            size_t *rev_count_tmp = this->rev_count_tmp;
-            // sycl::buffer<size_t> maxBuf { &p.m_countAlive, 1 };
-            // auto maxReduction = reduction(maxBuf, h, sycl::plus<>());
-            // std::cout << "rev_size = " << rev_size << "\n";
-            h.parallel_for(sycl::range<1>(size_all), [=](sycl::id<1> idx_d){
+            auto alive_acc = p.m_alive;
+            h.parallel_for(sycl::range<1>(p.m_highWater), [=](sycl::id<1> idx_d){
                 size_t idx = idx_d.get(0);
-                if (buf_acc[idx].alive == false && *rev_count_tmp < rev_size)
+                if (alive_acc[idx] == 0 && *counter < count)
                 {
 
-                    sycl::atomic_ref<size_t, sycl::memory_order::relaxed, sycl::memory_scope::device> rev_ref(*rev_count_tmp);
+                    sycl::atomic_ref<size_t, sycl::memory_order::relaxed, sycl::memory_scope::device> rev_ref(*counter);
                     size_t prev_val =  rev_ref.fetch_add(1);
-                    if( prev_val < rev_size)
+                    if( prev_val < count)
                     {
-                        buf_acc[idx].alive = true;
-                        buf_acc[idx].pos = random_vec(posMin, posMax, current_time + idx * 1000);
-                        buf_acc[idx].startCol = random_vec(m_minStartCol, m_maxStartCol, current_time + idx * 1000);
-                        buf_acc[idx].endCol = random_vec(m_minEndCol, m_maxEndCol, current_time + idx * 1000);
-                        buf_acc[idx].vel = random_vec(m_minStartVel, m_maxStartVel, current_time + idx * 1000);
-                        buf_acc[idx].time.x() = buf_acc[idx].time.y() = random_rangef(m_minTime, m_maxTime, current_time + idx * 1000);
-                        buf_acc[idx].time.z() = (float)0.0;
-                        buf_acc[idx].time.w() = (float)1.0 / buf_acc[idx].time.x();
-                        
-                        // rev_ref.fetch_sub(1);
-                        // max += 1;
-                        // return ;
+                        alive_acc[idx] = 1;
+                        buf_acc[idx] = fresh_particle(spawn, idx, prev_val);
                     }
-                    // size_t i = idx;
                 }
-                
             });
         }).wait();
+        q.copy<size_t>(counter, &reused, 1).wait();
+        reused = std::min(reused, count);
+    }
 
-        // p.m_countAlive += rev_size;
-        // auto threadWork = [&](size_t threadId) {
-        //     // Start at threadId and increment by numThreads
-        //     // std::cout << "thread id = " << threadId << "\n";
-        //     for (size_t i = startId + threadId; i < endId; i += numThreads) {
-            
-        //     p.m_particle[i].pos = random_vec(posMin, posMax, current_time + i * 1000);
-        //     p.m_particle[i].startCol = random_vec(m_minStartCol, m_maxStartCol, current_time + i * 1000);
-        //     p.m_particle[i].endCol = random_vec(m_minEndCol, m_maxEndCol, current_time + i * 1000);
-        //     p.m_particle[i].vel = random_vec(m_minStartVel, m_maxStartVel, current_time + i * 1000);
-        //     p.m_particle[i].time.x() = p.m_particle[i].time.y() = random_rangef(m_minTime, m_maxTime, current_time + i * 1000);
-        //     p.m_particle[i].time.z() = (float)0.0;
-        //     p.m_particle[i].time.w() = (float)1.0 / p.m_particle[i].time.x();
-        //     }
-        // };
-
-        
-        
-
-        // for (size_t i = startId; i < endId; ++i)
-        // {
-        //     p.m_particle[i].pos = random_vec(posMin, posMax);
-        //     p.m_particle[i].startCol = random_vec(m_minStartCol, m_maxStartCol);
-        //     p.m_particle[i].endCol = random_vec(m_minEndCol, m_maxEndCol);
-        //     p.m_particle[i].vel = random_vec(m_minStartVel, m_maxStartVel);
-        //     p.m_particle[i].time.x() = p.m_particle[i].time.y() = my_randf(m_minTime, m_maxTime);
-        //     p.m_particle[i].time.z() = (float)0.0;
-        //     p.m_particle[i].time.w() = (float)1.0 / p.m_particle[i].time.x();
-        // }
+    size_t start = p.m_highWater;
+    size_t fresh = p.grow(count - reused);
+    if (fresh == 0) return reused;
+    q.submit([&](sycl::handler &h){
+        auto buf_acc = p.m_particle;
+        auto alive_acc = p.m_alive;
+        h.parallel_for(sycl::range<1>(fresh), [=](sycl::id<1> idx_d){
+            size_t idx = start + idx_d.get(0);
+            alive_acc[idx] = 1;
+            buf_acc[idx] = fresh_particle(spawn, idx, reused + idx_d.get(0));
+        });
+    }).wait();
+    return reused + fresh;
+}
+
+// the parameters of every component and nothing else, this is what gets
+// copied into the spawn kernel
+template<class... Components>
+class EmitterParams : public Components...
+{
+public:
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        (Components::spawn(pt, ctx), ...);
+    }
+
+    // out is the register particle of spawn_slots, acc and col are not owned
+    // by any component and come cleared from there
+    void emit(Particle &out, const SpawnCtx &ctx) const
+    {
+        spawn(out, ctx);
+    }
+};
+
+template<class... Components>
+struct sycl::is_device_copyable<EmitterParams<Components...>> : std::true_type {};
+
+// e.g. Emitter<BoxPos, SphereVel, RangeColor, RangeTime>: the components are
+// fused into a single spawn kernel, the particle is built in registers and
+// written to the pool once
+template<class... Components>
+class Emitter : public EmitterParams<Components...>
+{
+public:
+    unsigned long long m_seed{ 0 };
+    unsigned int m_frame{ 0 }; // philox counter, bumped once per generate()
+    bool m_lowDiscrepancy{ false }; // scrambled halton positions and velocities
+    float m_time{ 0.0f }; // simulation time, advanced by generate_curve()
+    Curve m_rateCurve; // .x is particles per second, used by generate_curve()
+    float m_rateScale{ 1.0f }; // multiplies the rate curve
+    sycl::queue q;
+    size_t *rev_count_tmp;
+    unsigned int *m_emitIndex; // particles emitted so far, lives on the device
+    float *m_rateCarry; // fractional particle left over by the rate curve
+    size_t *m_rateCount;
+public:
+    Emitter(): q(sycl::gpu_selector_v)
+    {
+        rev_count_tmp = sycl::malloc_device<size_t>(1, q);
+        m_emitIndex = sycl::malloc_device<unsigned int>(1, q);
+        m_rateCarry = sycl::malloc_device<float>(1, q);
+        m_rateCount = sycl::malloc_device<size_t>(1, q);
+        q.memset(rev_count_tmp, 0, sizeof(size_t));
+        q.memset(m_emitIndex, 0, sizeof(unsigned int));
+        q.memset(m_rateCarry, 0, sizeof(float));
+        q.wait();
+    }
+    Emitter(const Emitter &) = delete;
+    Emitter &operator=(const Emitter &) = delete;
+    ~Emitter()
+    {
+        sycl::free(rev_count_tmp, q);
+        sycl::free(m_emitIndex, q);
+        sycl::free(m_rateCarry, q);
+        sycl::free(m_rateCount, q);
+    }
+
+    void generate(Particle_system &p, size_t rev_size)
+    {
+        const EmitterParams<Components...> params = *this;
+        unsigned long long seed = m_seed;
+        unsigned int frame = m_frame++;
+        bool lowDiscrepancy = m_lowDiscrepancy;
+        HaltonScramble scramble = halton_scramble(seed);
+        float time = m_time;
+        unsigned int *emitIndex = m_emitIndex;
+
+        size_t spawned = spawn_slots(q, p, rev_size, rev_count_tmp, [=](Particle &out, size_t idx, size_t rank){
+            // consecutive points of the sequence, continuing where the last frame stopped
+            params.emit(out, SpawnCtx{ seed, idx, frame, lowDiscrepancy, *emitIndex + (unsigned int)rank, scramble, time });
+        });
+        q.single_task([=](){
+            *emitIndex += (unsigned int)spawned;
+        }).wait();
+    }
+
+    // advances m_time by dt and spawns what m_rateCurve asks for over that
+    // step. the curve is evaluated on the device, only the resulting count
+    // comes back. without a rate curve nothing is spawned.
+    void generate_curve(Particle_system &p, double dt)
+    {
+        m_time += (float)dt;
+        if (!m_rateCurve.valid()) return;
+        Curve rateCurve = m_rateCurve;
+        float rateScale = m_rateScale;
+        float time = m_time;
+        float localDT = (float)dt;
+        float *carry = m_rateCarry;
+        size_t *count = m_rateCount;
+        q.single_task([=](){
+            float want = sycl::max(rateCurve.eval(time).x(), 0.0f) * rateScale * localDT + *carry;
+            size_t c = (size_t)sycl::floor(want);
+            *carry = want - (float)c;
+            *count = c;
+        }).wait();
+        size_t rev_size = 0;
+        q.copy<size_t>(count, &rev_size, 1).wait();
+        generate(p, rev_size);
     }
 };
 
-// class RoundPosGen 
-// {
-// public:
-//     sycl::vec<float, 4> m_center{ 0.0 };
-//     float m_radX{ 0.0 };
-//     float m_radY{ 0.0 };
-// public:
-//     RoundPosGen() { }
-//     RoundPosGen(const sycl::vec<float, 4> &center, double radX, double radY)
-//         : m_center(center)
-//         , m_radX((float)radX)
-//         , m_radY((float)radY)
-//     { }
-
-//     void generate(Particle_system &p, size_t startId, size_t endId)
-//     {
-//         for (size_t i = startId; i < endId; ++i)
-//         {
-//             double ang = my_randf(0.0, M_PI*2.0);
-//             p.m_particle[i].pos = m_center + sycl::vec<float, 4>(m_radX*sin(ang), m_radY*cos(ang), 0.0, 1.0);
-//         }
-//     }
-// };
-
-// class BasicColorGen 
-// {
-// public:
-// public:
-//     BasicColorGen() { }
-
-//     void generate(Particle_system &p, size_t startId, size_t endId)
-//     {
-//         for (size_t i = startId; i < endId; ++i)
-//         {
-//         }
-//     }};
-
-// class BasicVelGen 
-// {
-// public:
-// public:
-//     BasicVelGen() { }
-
-//     void generate(Particle_system &p, size_t startId, size_t endId)
-//     {
-//         for (size_t i = startId; i < endId; ++i)
-//         {
-//         }
-//     }
-// };
-
-// class SphereVelGen 
-// {
-// public:
-//     float m_minVel{ 0.0f };
-//     float m_maxVel{ 0.0f };
-// public:
-//     SphereVelGen() { }
-
-//     void generate(Particle_system &p, size_t startId, size_t endId)
-//     {
-//         float phi, theta, v, r;
-//         for (size_t i = startId; i < endId; ++i)
-//         {
-//             phi = my_randf(-M_PI, M_PI);
-//             theta = my_randf(-M_PI, M_PI);
-//             v = my_randf(m_minVel, m_maxVel);
-
-//             r = v*sinf(phi);
-//             // p.m_particle[i].vel.z() = v*cosf(phi);
-//             // p.m_particle[i].vel.x() = r*cosf(theta);
-//             // p.m_particle[i].vel.y() = r*sinf(theta);
-//             p.m_particle[i].vel = sycl::vec<float, 4>(r*cosf(theta), r*sinf(theta), v*cosf(phi), 1.0);
-//         }
-//     }
-// };
-
-// class BasicTimeGen 
-// {
-// public:
-// public:
-//     BasicTimeGen() { }
-
-//     void generate(Particle_system &p, size_t startId, size_t endId)
-//     {
-//         for (size_t i = startId; i < endId; ++i)
-//         {
-           
-//             // p.m_particle[i].time = sycl::vec<float, 4>(my_randf(m_minTime, m_maxTime), my_randf(m_minTime, m_maxTime), 0.0f, 1.0f / p.m_particle[i].time.x());
-            
-//         }
-//     }
-// };
\ No newline at end of file
+// the default rain cloud: a box of random positions and velocities
+using Gen = Emitter<BoxPos, BoxVel, RangeColor, RangeTime>;
+
+// the same cloud with keyframed rate, colors and life time
+using CurveGen = Emitter<BoxPos, BoxVel, CurveColor, CurveTime>;
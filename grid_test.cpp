@@ -0,0 +1,118 @@
+#include <sycl/sycl.hpp>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "my_random.hpp"
+#include "particle.hpp"
+#include "spatial_grid.hpp"
+#include "sph.hpp"
+
+// SpatialGrid on the CPU device: build time for a pool of uniformly scattered
+// particles (1M by default), then the neighbours found through the grid
+// against brute force for a subset of them. exits 1 if a count differs.
+// last a full SphSolver step (grid build, density, forces) on the same pool,
+// which sits at about the rest density.
+
+const size_t CHECKED = 256;
+
+template<typename Run>
+double time_ms(int reps, Run run)
+{
+    run(); // warm up, jit and first touch of the buffers
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int r = 0; r < reps; ++r)
+        run();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / reps;
+}
+
+int main(int argc, char **argv) {
+    size_t size = 1000000;
+    int reps = 10;
+    if(argc > 1)
+        size = std::stoul(std::string(argv[1]));
+
+    sycl::device device(sycl::cpu_selector_v);
+    std::cout << "Device: " << device.get_info<sycl::info::device::name>() << std::endl;
+    unsigned long long seed = time(0);
+
+    // a cube holding about one particle per 5^3, the sph rest density of h = 10
+    const float side = 5.0f * std::cbrt((float)size);
+    Particle_system p(size, device);
+    {
+        Particle *buf_acc = p.m_particle;
+        unsigned char *alive_acc = p.m_alive;
+        p.q.submit([&](sycl::handler &h) {
+            h.parallel_for(sycl::range<1>(size), [=](sycl::id<1> id) {
+                size_t idx = id.get(0);
+                Particle pt;
+                pt.pos = philox_randf(seed, idx, 0, STREAM_POS) * side;
+                pt.pos.w() = 1.0f;
+                pt.vel = pt.acc = sycl::vec<float, 4>(0.0f);
+                pt.startCol = pt.endCol = pt.col = sycl::vec<float, 4>(255.0f);
+                pt.time = sycl::vec<float, 4>(1e6f, 1e6f, 0.0f, 1e-6f);
+                buf_acc[idx] = pt;
+                alive_acc[idx] = 1;
+            });
+        }).wait();
+        p.m_highWater = size;
+        p.m_countAlive = size;
+    }
+
+    SpatialGrid grid(10.0f, (unsigned int)size, device);
+    double build = time_ms(reps, [&](){ grid.build(p); });
+    std::cout << "grid build : " << build << " ms for " << size << " particles" << std::endl;
+
+    // neighbours within a cell size of every size / CHECKED-th particle
+    const size_t checked = std::min(CHECKED, size);
+    const size_t stride = size / checked;
+    const float r2 = grid.m_cellSize * grid.m_cellSize;
+    unsigned int *found = sycl::malloc_device<unsigned int>(checked, p.q);
+    {
+        const GridView view = grid.view();
+        const Particle *buf_acc = p.m_particle;
+        p.q.submit([&](sycl::handler &h) {
+            h.parallel_for(sycl::range<1>(checked), [=](sycl::id<1> id) {
+                size_t i = id.get(0) * stride;
+                const sycl::vec<float, 4> pi = buf_acc[i].pos;
+                unsigned int count = 0;
+                view.for_each_neighbour(pi, [&](unsigned int j){
+                    sycl::vec<float, 4> d = pi - buf_acc[j].pos;
+                    if(j != i && d.x() * d.x() + d.y() * d.y() + d.z() * d.z() < r2) count++;
+                });
+                found[id.get(0)] = count;
+            });
+        }).wait();
+    }
+    std::vector<unsigned int> gridCount(checked);
+    p.q.copy<unsigned int>(found, gridCount.data(), checked).wait();
+    sycl::free(found, p.q);
+
+    std::vector<Particle> host(size);
+    p.q.copy<Particle>(p.m_particle, host.data(), size).wait();
+    size_t wrong = 0, total = 0;
+    for(size_t c = 0; c < checked; ++c)
+    {
+        const size_t i = c * stride;
+        unsigned int count = 0;
+        for(size_t j = 0; j < size; ++j)
+        {
+            sycl::vec<float, 4> d = host[i].pos - host[j].pos;
+            if(j != i && d.x() * d.x() + d.y() * d.y() + d.z() * d.z() < r2) count++;
+        }
+        total += count;
+        if(count != gridCount[c]) wrong++;
+    }
+    bool ok = wrong == 0;
+    std::cout << "neighbours : " << checked << " particles, " << (double)total / checked << " each on average, "
+              << wrong << " differ from brute force " << (ok ? "ok" : "FAIL") << std::endl;
+
+    SphSolver sph((unsigned int)size, device);
+    sph.m_floorY = 2.0f * side; // below the whole cube
+    double step = time_ms(reps, [&](){ sph.update(1.0 / 60.0, p); });
+    std::cout << "sph step   : " << step << " ms for " << size << " particles" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <iostream>
+#include "./include/raylib.h"
+#include "generator.hpp"
+#include "alias_table.hpp"
+
+// pixels of a raylib image kept in device memory, with an alias table
+// weighted by pixel luminance, built once at load time
+class ImageSurface
+{
+public:
+    sycl::vec<float, 4> *m_pixels{ nullptr }; // 0..255 like the particle colors
+    int m_width{ 0 };
+    int m_height{ 0 };
+    AliasTable m_alias;
+    sycl::queue q;
+public:
+    ImageSurface(): q(sycl::gpu_selector_v) {}
+    ImageSurface(const ImageSurface &) = delete;
+    ImageSurface &operator=(const ImageSurface &) = delete;
+    ~ImageSurface()
+    {
+        if (m_pixels) sycl::free(m_pixels, q);
+    }
+
+    bool load(const char *path)
+    {
+        Image im = LoadImage(path);
+        if (im.data == nullptr)
+        {
+            std::cout << "could not load image: " << path << "\n";
+            return false;
+        }
+        bool ok = load(im);
+        UnloadImage(im);
+        return ok;
+    }
+
+    bool load(Image im)
+    {
+        Image copy = ImageCopy(im);
+        ImageFormat(&copy, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        size_t count = (size_t)copy.width * copy.height;
+        const unsigned char *data = (const unsigned char *)copy.data;
+        std::vector<sycl::vec<float, 4>> pixels(count);
+        std::vector<float> luminance(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            pixels[i] = sycl::vec<float, 4>(data[i * 4], data[i * 4 + 1], data[i * 4 + 2], data[i * 4 + 3]);
+            // rec. 709 luma, transparent pixels never emit
+            luminance[i] = (0.2126f * data[i * 4] + 0.7152f * data[i * 4 + 1] + 0.0722f * data[i * 4 + 2]) * (data[i * 4 + 3] / 255.0f);
+        }
+        int width = copy.width;
+        int height = copy.height;
+        UnloadImage(copy);
+        if (!m_alias.build(luminance))
+        {
+            std::cout << "image is black, nothing to emit\n";
+            return false;
+        }
+        if (m_pixels) sycl::free(m_pixels, q);
+        m_pixels = sycl::malloc_device<sycl::vec<float, 4>>(count, q);
+        q.memcpy(m_pixels, pixels.data(), sizeof(sycl::vec<float, 4>) * count).wait();
+        m_width = width;
+        m_height = height;
+        return true;
+    }
+};
+
+// spawn component: picks a pixel with probability proportional to its
+// luminance, jitters inside it and maps it onto the plane
+// m_origin + s * m_axisU + t * m_axisV (s, t in [0, 1], t going down the
+// image). the particle takes the pixel color as start and end color, so list
+// it after any color component.
+class ImagePosColor
+{
+public:
+    const sycl::vec<float, 4> *m_pixels{ nullptr };
+    AliasView m_pixelAlias;
+    int m_width{ 0 };
+    int m_height{ 0 };
+    sycl::vec<float, 4> m_origin{ -100.0f, -100.0f, -100.0f, 0.0f };
+    sycl::vec<float, 4> m_axisU{ 200.0f, 0.0f, 0.0f, 0.0f };
+    sycl::vec<float, 4> m_axisV{ 0.0f, 0.0f, 200.0f, 0.0f };
+
+    void attach(const ImageSurface &surface)
+    {
+        m_pixels = surface.m_pixels;
+        m_pixelAlias = surface.m_alias.view();
+        m_width = surface.m_width;
+        m_height = surface.m_height;
+    }
+
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        pt.pos = m_origin;
+        pt.pos.w() = 1.0f;
+        if (m_pixels == nullptr) return;
+        sycl::vec<float, 4> u = ctx.rand(STREAM_POS);
+        unsigned int i = m_pixelAlias.sample(u.x(), u.y());
+        float s = ((float)(i % m_width) + u.z()) / m_width;
+        float t = ((float)(i / m_width) + u.w()) / m_height;
+        pt.pos += s * m_axisU + t * m_axisV;
+        pt.pos.w() = 1.0f;
+        pt.startCol = pt.endCol = pt.col = m_pixels[i];
+    }
+};
+
+using ImageGen = Emitter<ImagePosColor, BoxVel, RangeTime>;
@@ -1,5 +1,8 @@
 #include "updater.hpp"
 #include "generator.hpp"
+#include "emitter_table.hpp"
+#include "mesh_emitter.hpp"
+#include "image_emitter.hpp"
 #include "particle.hpp"
 #include <sycl/sycl.hpp>
 #include <iostream>
@@ -10,7 +13,10 @@
 #include <cmath> // For M_PI if available, otherwise define PI
 #include "renderer.hpp"
 #include "input.hpp"
+#include "budget.hpp"
+#include "sph.hpp"
 #include <string>
+#include <memory>
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
@@ -46,14 +52,16 @@ void simpl_sort(size_t *data, size_t size)
     }
 }
 
-void emit(double dt, Particle_system &p, Gen gen, size_t m_emitRate)
+template<class Generator>
+void emit(double dt, Particle_system &p, Generator &gen, size_t m_emitRate, size_t cap)
 {
-    if (p.m_countAlive >= p.size) return; // No more particles to emit
+    cap = std::min(cap, p.size);
+    if (p.m_countAlive >= cap) return; // No more particles to emit
     if (m_emitRate <= 0) return;              // No emission rate
 
     const size_t maxNewParticles = static_cast<size_t>(dt*m_emitRate);
     const size_t count_start = p.m_countAlive;
-    const size_t count_end = std::min(count_start + maxNewParticles, p.size -1);
+    const size_t count_end = std::min(count_start + maxNewParticles, cap -1);
     if((count_end - count_start) <= 0) return; 
 
     // p.q.submit([&](sycl::handler &h){
@@ -73,10 +81,39 @@ void emit(double dt, Particle_system &p, Gen gen, size_t m_emitRate)
 int main(int arg_num, char **args)
 {
     size_t num_particles = 1000000;
-    if(arg_num  > 1)
+    unsigned long long seed = time(0);
+    size_t num_emitters = 0;
+    std::string mesh_path;
+    float mesh_scale = 100.0f;
+    std::string image_path;
+    bool low_discrepancy = false;
+    bool curves = false;
+    bool splashes = false;
+    double target_ms = 0.0;
+    bool budget_render = false;
+    size_t num_attractors = 0;
+    bool sph_mode = false;
+    float nbody_theta = -1.0f;
+    size_t pm_res = 0;
+    bool wind_grid = false;
+    bool scene_colliders = false;
+    bool scene_sdf = false;
+    std::string sdf_mesh_path;
+    std::string collider_mesh_path;
+    std::string terrain_path;
+    float terrain_height = 300.0f;
+    bool curl_noise = false;
+    bool use_chain = false;
+    UpdaterPreset chain_preset = PRESET_RAIN;
+    Integrator integrator = INTEGRATOR_SEMI_IMPLICIT;
+    float cfl_distance = 0.0f;
+    unsigned int max_substeps = 8;
+    bool sim_lod = false;
+    float lod_distance = 500.0f;
+    for(int i = 1; i < arg_num; i++)
     {
-
-        if(std::string(args[1]) == "--help")
+        std::string arg(args[i]);
+        if(arg == "--help")
         {
             std::cout << "usage:\n";
             std::cout << "./getting_pissed_on_simulator\n";
@@ -84,28 +121,365 @@ int main(int arg_num, char **args)
             std::cout << "./getting_pissed_on_simulator -n {number of particles}\n";
             std::cout << "# to run with a costom number of particles\n";
             std::cout << "# example: ./getting_pissed_on_simulator -n 10000\n";
+            std::cout << "./getting_pissed_on_simulator --seed {seed}\n";
+            std::cout << "# to replay the same random streams as an earlier run\n";
+            std::cout << "./getting_pissed_on_simulator --emitters {number of emitters}\n";
+            std::cout << "# rain from many small clouds in a ring, all spawned in one launch\n";
+            std::cout << "./getting_pissed_on_simulator --mesh {model file} [--mesh-scale {scale}]\n";
+            std::cout << "# rain starts on the surface of the model (obj, gltf, iqm, ...), scaled by 100 by default\n";
+            std::cout << "./getting_pissed_on_simulator --image {image file}\n";
+            std::cout << "# bright pixels of the image emit more, particles take the pixel color\n";
+            std::cout << "# --emitters, --mesh, --image and --curves each replace the emitter, give at most one of them\n";
+            std::cout << "./getting_pissed_on_simulator --low-discrepancy\n";
+            std::cout << "# spawn positions and velocities from a scrambled halton sequence, even coverage with fewer particles\n";
+            std::cout << "./getting_pissed_on_simulator --curves\n";
+            std::cout << "# a 30 second storm on a loop: rate, colors, life time and wind follow keyframed curves\n";
+            std::cout << "./getting_pissed_on_simulator --splash\n";
+            std::cout << "# drops hitting the floor spawn small splashes, straight from the update kernel\n";
+            std::cout << "./getting_pissed_on_simulator --target-ms {milliseconds} [--budget-render]\n";
+            std::cout << "# hold a frame time by lowering emission and the particle cap (and render resolution with --budget-render)\n";
+            std::cout << "# example: ./getting_pissed_on_simulator --target-ms 16.6\n";
+            std::cout << "./getting_pissed_on_simulator --attractors {number of attractors}\n";
+            std::cout << "# scatter point attractors and repulsors in the rain, past 4096 they are baked into a grid\n";
+            std::cout << "./getting_pissed_on_simulator --sph\n";
+            std::cout << "# the rain is a fluid (smoothed-particle hydrodynamics): it pools and flows on the floor\n";
+            std::cout << "./getting_pissed_on_simulator --nbody [--theta {opening angle}]\n";
+            std::cout << "# every drop pulls on every other one through a barnes-hut octree, theta 0.5 by default (0 is exact)\n";
+            std::cout << "./getting_pissed_on_simulator --pm [--pm-grid {cells per axis}]\n";
+            std::cout << "# same pull from a particle-mesh solver (fft poisson solve), for tens of millions of drops, 128 cells by default\n";
+            std::cout << "./getting_pissed_on_simulator --wind\n";
+            std::cout << "# the random global gusts become an air grid (PIC/FLIP): local gusts and a wake behind a block\n";
+            std::cout << "./getting_pissed_on_simulator --colliders\n";
+            std::cout << "# an umbrella, an awning, a person and a ramp in the rain, all tested in one pass\n";
+            std::cout << "./getting_pissed_on_simulator --sdf\n";
+            std::cout << "# the same scene baked once into a signed distance grid, one lookup per drop\n";
+            std::cout << "./getting_pissed_on_simulator --sdf-mesh {model file} [--mesh-scale {scale}]\n";
+            std::cout << "# a closed model baked into the distance grid on the gpu (jump flooding), the rain lands on it\n";
+            std::cout << "./getting_pissed_on_simulator --mesh-collider {model file} [--mesh-scale {scale}]\n";
+            std::cout << "# exact collisions with a slowly turning model, bvh built on the gpu and refitted every frame\n";
+            std::cout << "./getting_pissed_on_simulator --terrain {heightmap image} [--terrain-height {height}]\n";
+            std::cout << "# the floor follows the image, white is 300 above it by default, drops bounce off the slopes\n";
+            std::cout << "./getting_pissed_on_simulator --curl\n";
+            std::cout << "# swirling turbulence from a baked, scrolling curl-noise volume instead of the random global gusts\n";
+            std::cout << "./getting_pissed_on_simulator --chain {rain|gravity|attract|poscolor|velcolor}\n";
+            std::cout << "# update with one of the precompiled single-kernel updater chains instead of the euler updater and its extras,\n";
+            std::cout << "# the options that only the euler updater runs (--splash, --wind, --colliders, --lod, ...) are refused with it\n";
+            std::cout << "./getting_pissed_on_simulator --integrator {euler|semi|verlet|rk2}\n";
+            std::cout << "# how the updater steps positions and velocities, semi-implicit euler by default\n";
+            std::cout << "./getting_pissed_on_simulator --cfl {distance} [--max-substeps {steps}]\n";
+            std::cout << "# substeps sized from the fastest drop so none moves more than distance per step, at most 8 by default\n";
+            std::cout << "./getting_pissed_on_simulator --lod [--lod-distance {distance}]\n";
+            std::cout << "# drops far from the camera are stepped every 2nd or 4th frame, the ones out of view every 8th, 500 by default\n";
             return 0;
         }
-        if(std::string(args[1]) == "-n")
+        else if(arg == "-n")
         {
-            if(arg_num < 3)
+            if(i + 1 >= arg_num)
             {
                 std::cout << "missing number of particles\n";
                 return -1;
             }
-            long long num = std::stoll(std::string(args[2]));
+            long long num = std::stoll(std::string(args[i + 1]));
+            if(num <= 0)
+            {
+                std::cout << "must be a positive number\n";
+                return -1;
+            }
+            num_particles = std::stoul(std::string(args[++i]));
+        }
+        else if(arg == "--seed")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing seed\n";
+                return -1;
+            }
+            seed = std::stoull(std::string(args[++i]));
+        }
+        else if(arg == "--emitters")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing number of emitters\n";
+                return -1;
+            }
+            long long num = std::stoll(std::string(args[i + 1]));
+            if(num <= 0)
+            {
+                std::cout << "must be a positive number\n";
+                return -1;
+            }
+            num_emitters = std::stoul(std::string(args[++i]));
+        }
+        else if(arg == "--mesh")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing mesh file\n";
+                return -1;
+            }
+            mesh_path = args[++i];
+        }
+        else if(arg == "--mesh-scale")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing mesh scale\n";
+                return -1;
+            }
+            mesh_scale = std::stof(std::string(args[++i]));
+        }
+        else if(arg == "--image")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing image file\n";
+                return -1;
+            }
+            image_path = args[++i];
+        }
+        else if(arg == "--low-discrepancy")
+        {
+            low_discrepancy = true;
+        }
+        else if(arg == "--curves")
+        {
+            curves = true;
+        }
+        else if(arg == "--splash")
+        {
+            splashes = true;
+        }
+        else if(arg == "--target-ms")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing frame time target\n";
+                return -1;
+            }
+            target_ms = std::stod(std::string(args[++i]));
+            if(target_ms <= 0.0)
+            {
+                std::cout << "must be a positive number\n";
+                return -1;
+            }
+        }
+        else if(arg == "--budget-render")
+        {
+            budget_render = true;
+        }
+        else if(arg == "--sph")
+        {
+            sph_mode = true;
+        }
+        else if(arg == "--nbody")
+        {
+            if(nbody_theta < 0.0f) nbody_theta = 0.5f;
+        }
+        else if(arg == "--integrator")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing integrator name\n";
+                return -1;
+            }
+            if(!integrator_from_name(std::string(args[++i]), integrator))
+            {
+                std::cout << "unknown integrator: " << args[i] << ", see --help\n";
+                return -1;
+            }
+        }
+        else if(arg == "--cfl")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing distance per step\n";
+                return -1;
+            }
+            cfl_distance = std::stof(std::string(args[++i]));
+            if(cfl_distance <= 0.0f)
+            {
+                std::cout << "must be a positive number\n";
+                return -1;
+            }
+        }
+        else if(arg == "--max-substeps")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing number of substeps\n";
+                return -1;
+            }
+            long long num = std::stoll(std::string(args[i + 1]));
+            if(num <= 0)
+            {
+                std::cout << "must be a positive number\n";
+                return -1;
+            }
+            max_substeps = std::stoul(std::string(args[++i]));
+        }
+        else if(arg == "--lod")
+        {
+            sim_lod = true;
+        }
+        else if(arg == "--lod-distance")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing distance\n";
+                return -1;
+            }
+            lod_distance = std::stof(std::string(args[++i]));
+            if(lod_distance <= 0.0f)
+            {
+                std::cout << "must be a positive number\n";
+                return -1;
+            }
+            sim_lod = true;
+        }
+        else if(arg == "--chain")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing chain name\n";
+                return -1;
+            }
+            if(!updater_preset_from_name(std::string(args[++i]), chain_preset))
+            {
+                std::cout << "unknown chain: " << args[i] << ", see --help\n";
+                return -1;
+            }
+            use_chain = true;
+        }
+        else if(arg == "--curl")
+        {
+            curl_noise = true;
+        }
+        else if(arg == "--terrain")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing heightmap image\n";
+                return -1;
+            }
+            terrain_path = args[++i];
+        }
+        else if(arg == "--terrain-height")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing terrain height\n";
+                return -1;
+            }
+            terrain_height = std::stof(std::string(args[++i]));
+        }
+        else if(arg == "--mesh-collider")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing mesh file\n";
+                return -1;
+            }
+            collider_mesh_path = args[++i];
+        }
+        else if(arg == "--sdf")
+        {
+            scene_sdf = true;
+        }
+        else if(arg == "--sdf-mesh")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing mesh file\n";
+                return -1;
+            }
+            sdf_mesh_path = args[++i];
+        }
+        else if(arg == "--colliders")
+        {
+            scene_colliders = true;
+        }
+        else if(arg == "--wind")
+        {
+            wind_grid = true;
+        }
+        else if(arg == "--pm")
+        {
+            if(pm_res == 0) pm_res = 128;
+        }
+        else if(arg == "--pm-grid")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing number of cells\n";
+                return -1;
+            }
+            pm_res = std::stoul(std::string(args[++i]));
+            if(pm_res < 8 || pm_res > PM_MAX_RES)
+            {
+                std::cout << "must be between 8 and " << PM_MAX_RES << "\n";
+                return -1;
+            }
+        }
+        else if(arg == "--theta")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing opening angle\n";
+                return -1;
+            }
+            nbody_theta = std::stof(std::string(args[++i]));
+            if(nbody_theta < 0.0f)
+            {
+                std::cout << "must not be negative\n";
+                return -1;
+            }
+        }
+        else if(arg == "--attractors")
+        {
+            if(i + 1 >= arg_num)
+            {
+                std::cout << "missing number of attractors\n";
+                return -1;
+            }
+            long long num = std::stoll(std::string(args[i + 1]));
             if(num <= 0)
             {
                 std::cout << "must be a positive number\n";
                 return -1;
             }
-            num_particles = std::stoul(std::string(args[2]));
+            num_attractors = std::stoul(std::string(args[++i]));
         }
+        else
+        {
+            std::cout << "unknown argument: " << arg << ", see --help\n";
+            return -1;
+        }
+    }
+    // the chain replaces EulerUpdater, everything hooked into it would be ignored
+    if(use_chain && (splashes || num_attractors > 0 || curves || nbody_theta >= 0.0f || pm_res > 0 || wind_grid ||
+                     scene_colliders || scene_sdf || !sdf_mesh_path.empty() || !collider_mesh_path.empty() || !terrain_path.empty() ||
+                     curl_noise || integrator != INTEGRATOR_SEMI_IMPLICIT || cfl_distance > 0.0f || sim_lod))
+    {
+        std::cout << "--chain can not be combined with --splash, --attractors, --curves, --nbody, --pm, --wind, --colliders, --sdf, --sdf-mesh,\n"
+                  << "--mesh-collider, --terrain, --curl, --integrator, --cfl or --lod, they all run inside the euler updater\n";
+        return -1;
     }
+    // the frame loop runs a single emitter, a second one would be ignored
+    if((num_emitters > 0) + curves + !mesh_path.empty() + !image_path.empty() > 1)
+    {
+        std::cout << "--emitters, --mesh, --image and --curves can not be combined, pick one\n";
+        return -1;
+    }
+    std::cout << "seed: " << seed << "\n";
         
     Particle_system system(num_particles);
     
     EulerUpdater eu;
+    eu.m_seed = seed;
+    eu.m_integrator = integrator;
+    eu.m_cflDistance = cfl_distance;
+    eu.m_maxSubsteps = max_substeps;
 
     InitWindow(0, 0, "Getting Pissed On Simulator");
     int screenWidth = GetMonitorWidth(0);
@@ -124,8 +498,240 @@ int main(int arg_num, char **args)
     Texture2D tex = LoadTextureFromImage(canvas);
     Renderer renderer(screenWidth, screenHeight);
     Gen gen;
+    gen.m_seed = seed;
+    gen.m_lowDiscrepancy = low_discrepancy;
     MyInput input;
     size_t emmit_count = 30000;
+    std::unique_ptr<GenTable> table;
+    if(num_emitters > 0)
+    {
+        table = std::make_unique<GenTable>();
+        table->m_seed = seed;
+        for(size_t i = 0; i < num_emitters; i++)
+        {
+            // small clouds on a ring around the default one, sharing its rate
+            GenTable::Params cloud = gen;
+            float ang = (float)i / num_emitters * 2.0f * (float)M_PI;
+            cloud.m_pos = sycl::vec<float, 4>(300.0f * std::cos(ang), 0.0f, 300.0f * std::sin(ang), 0.0f);
+            cloud.m_maxStartPosOffset = sycl::vec<float, 4>(20.0f);
+            table->add(cloud, (float)emmit_count / num_emitters);
+        }
+    }
+    std::unique_ptr<MeshSurface> meshSurface;
+    std::unique_ptr<MeshGen> meshGen;
+    if(!mesh_path.empty())
+    {
+        meshSurface = std::make_unique<MeshSurface>();
+        if(meshSurface->load(mesh_path.c_str()))
+        {
+            meshGen = std::make_unique<MeshGen>();
+            meshGen->m_seed = seed;
+            meshGen->m_lowDiscrepancy = low_discrepancy;
+            meshGen->attach(*meshSurface);
+            meshGen->m_scale = mesh_scale;
+            std::cout << "emitting from " << meshSurface->m_triangleCount << " triangles\n";
+        }
+    }
+    std::unique_ptr<ImageSurface> imageSurface;
+    std::unique_ptr<ImageGen> imageGen;
+    if(!image_path.empty())
+    {
+        imageSurface = std::make_unique<ImageSurface>();
+        if(imageSurface->load(image_path.c_str()))
+        {
+            imageGen = std::make_unique<ImageGen>();
+            imageGen->m_seed = seed;
+            imageGen->m_lowDiscrepancy = low_discrepancy;
+            imageGen->attach(*imageSurface);
+            std::cout << "emitting from a " << imageSurface->m_width << "x" << imageSurface->m_height << " image\n";
+        }
+    }
+    std::unique_ptr<CurveBank> curveBank;
+    std::unique_ptr<CurveGen> curveGen;
+    if(curves)
+    {
+        curveBank = std::make_unique<CurveBank>();
+        curveGen = std::make_unique<CurveGen>();
+        curveGen->m_seed = seed;
+        curveGen->m_lowDiscrepancy = low_discrepancy;
+        // a storm building up and calming down every 30 seconds
+        size_t rate = curveBank->add({ { { 5000.0f, 0.0f, 0.0f, 0.0f }, 0.0f },
+                                       { { 60000.0f, 0.0f, 0.0f, 0.0f }, 12.0f },
+                                       { { 40000.0f, 0.0f, 0.0f, 0.0f }, 18.0f },
+                                       { { 5000.0f, 0.0f, 0.0f, 0.0f }, 30.0f } }, CURVE_CUBIC, true);
+        size_t minStart = curveBank->add({ { { 255.0f, 0.0f, 0.0f, 255.0f }, 0.0f },
+                                           { { 0.0f, 0.0f, 255.0f, 255.0f }, 15.0f },
+                                           { { 255.0f, 0.0f, 0.0f, 255.0f }, 30.0f } }, CURVE_LINEAR, true);
+        size_t maxStart = curveBank->add({ { { 255.0f, 150.0f, 150.0f, 255.0f }, 0.0f },
+                                           { { 150.0f, 150.0f, 255.0f, 255.0f }, 15.0f },
+                                           { { 255.0f, 150.0f, 150.0f, 255.0f }, 30.0f } }, CURVE_LINEAR, true);
+        // .x min life, .y max life
+        size_t life = curveBank->add({ { { 10.0f, 60.0f, 0.0f, 0.0f }, 0.0f },
+                                       { { 5.0f, 20.0f, 0.0f, 0.0f }, 12.0f },
+                                       { { 10.0f, 60.0f, 0.0f, 0.0f }, 30.0f } }, CURVE_CUBIC, true);
+        // .x acc_min, .y acc_max, the wind gets gusty at the peak
+        size_t wind = curveBank->add({ { { -50.0f, 50.0f, 0.0f, 0.0f }, 0.0f },
+                                       { { -400.0f, 400.0f, 0.0f, 0.0f }, 12.0f },
+                                       { { -50.0f, 50.0f, 0.0f, 0.0f }, 30.0f } }, CURVE_CUBIC, true);
+        curveBank->upload();
+        curveGen->m_rateCurve = curveBank->get(rate);
+        curveGen->m_minStartColCurve = curveBank->get(minStart);
+        curveGen->m_maxStartColCurve = curveBank->get(maxStart);
+        curveGen->m_timeCurve = curveBank->get(life);
+        eu.m_accCurve = curveBank->get(wind);
+    }
+    std::unique_ptr<AttractorField> attractors;
+    if(num_attractors > 0)
+    {
+        attractors = std::make_unique<AttractorField>();
+        for(size_t i = 0; i < num_attractors; i++)
+        {
+            // 7 in 10 pull, the rest push, the total stays about the same for any count
+            sycl::vec<float, 4> u = philox_randf(seed, i, 0, STREAM_BULK);
+            float force = 20000.0f / std::sqrt((float)num_attractors) * (u.w() < 0.7f ? 1.0f : -1.0f);
+            attractors->add(sycl::vec<float, 4>(u.x() * 600.0f - 300.0f, u.y() * 900.0f, u.z() * 600.0f - 300.0f, force));
+        }
+        attractors->upload();
+        eu.m_attractors = attractors.get();
+        std::cout << num_attractors << " attractors" << (attractors->gridded() ? ", baked into a grid\n" : "\n");
+    }
+    std::unique_ptr<BarnesHut> nbody;
+    if(nbody_theta >= 0.0f)
+    {
+        nbody = std::make_unique<BarnesHut>();
+        nbody->m_theta = nbody_theta;
+        eu.m_nbody = nbody.get();
+    }
+    std::unique_ptr<PmSolver> pm;
+    if(pm_res > 0)
+    {
+        pm = std::make_unique<PmSolver>(pm_res);
+        eu.m_pm = pm.get();
+        std::cout << "particle-mesh gravity on a " << pm->res() << "^3 grid\n";
+    }
+    std::unique_ptr<WindGrid> wind;
+    if(wind_grid)
+    {
+        wind = std::make_unique<WindGrid>();
+        // the grid carries the gusts now, and the block leaves a wake in it
+        eu.acc_min = eu.acc_max = 0.0f;
+        wind->m_seed = seed;
+        wind->add_box(sycl::vec<float, 4>(-150.0f, 500.0f, -150.0f, 0.0f), sycl::vec<float, 4>(150.0f, 1000.0f, 150.0f, 0.0f));
+        wind->reset();
+        eu.m_windGrid = wind.get();
+    }
+    std::unique_ptr<ColliderSet> colliders;
+    if(scene_colliders || scene_sdf)
+    {
+        colliders = std::make_unique<ColliderSet>();
+        // an umbrella on its pole, a tilted awning, someone standing in the rain and a ramp
+        colliders->add_sphere(sycl::vec<float, 4>(0.0f, 520.0f, 0.0f, 0.0f), 140.0f, 0.3f, 0.1f);
+        colliders->add_capsule(sycl::vec<float, 4>(0.0f, 520.0f, 0.0f, 0.0f), sycl::vec<float, 4>(0.0f, 1000.0f, 0.0f, 0.0f), 6.0f, 0.2f, 0.5f);
+        colliders->add_box(sycl::vec<float, 4>(300.0f, 600.0f, 0.0f, 0.0f), sycl::vec<float, 4>(120.0f, 10.0f, 150.0f, 0.0f),
+                           quat_axis_angle(sycl::vec<float, 4>(0.0f, 0.0f, 1.0f, 0.0f), 0.3f), 0.1f, 0.05f);
+        colliders->add_capsule(sycl::vec<float, 4>(-300.0f, 760.0f, 0.0f, 0.0f), sycl::vec<float, 4>(-300.0f, 960.0f, 0.0f, 0.0f), 40.0f, 0.2f, 0.3f);
+        colliders->add_sphere(sycl::vec<float, 4>(-300.0f, 700.0f, 0.0f, 0.0f), 30.0f, 0.2f, 0.3f);
+        colliders->add_plane(sycl::vec<float, 4>(0.0f, -1.0f, -0.4f, 0.0f), -900.0f, 0.4f, 0.0f);
+        colliders->upload();
+        if(scene_colliders)
+            eu.m_colliders = colliders.get();
+    }
+    std::unique_ptr<SdfCollider> sdf;
+    if(scene_sdf)
+    {
+        sdf = std::make_unique<SdfCollider>();
+        sdf->bake(*colliders);
+        eu.m_sdf = sdf->view();
+    }
+    std::unique_ptr<MeshSurface> sdfMesh;
+    if(!sdf_mesh_path.empty())
+    {
+        sdfMesh = std::make_unique<MeshSurface>();
+        if(sdfMesh->load(sdf_mesh_path.c_str()))
+        {
+            if(!sdf)
+                sdf = std::make_unique<SdfCollider>();
+            // model space is y up, the world is y down: flip it and stand it on the floor
+            sdf->bake(sdfMesh->m_tris, sdfMesh->m_triangleCount, sycl::vec<float, 4>(mesh_scale, -mesh_scale, mesh_scale, 1.0f), sycl::vec<float, 4>(0.0f, eu.m_floorY, 0.0f, 0.0f));
+            eu.m_sdf = sdf->view();
+            std::cout << "baked " << sdfMesh->m_triangleCount << " triangles into the distance grid\n";
+        }
+        // the grid keeps its own copy
+        sdfMesh.reset();
+    }
+    std::unique_ptr<CurlNoiseVolume> curl;
+    if(curl_noise)
+    {
+        eu.acc_min = eu.acc_max = 0.0f;
+        curl = std::make_unique<CurlNoiseVolume>();
+        curl->m_seed = seed;
+        curl->bake();
+        eu.m_curl = curl->view();
+    }
+    std::unique_ptr<Terrain> terrain;
+    if(!terrain_path.empty())
+    {
+        terrain = std::make_unique<Terrain>();
+        terrain->m_heightScale = terrain_height;
+        if(terrain->load(terrain_path.c_str()))
+            eu.m_terrain = terrain->view();
+    }
+    std::unique_ptr<MeshSurface> colliderMesh;
+    std::unique_ptr<MeshCollider> meshCollider;
+    if(!collider_mesh_path.empty())
+    {
+        colliderMesh = std::make_unique<MeshSurface>();
+        if(colliderMesh->load(collider_mesh_path.c_str()))
+        {
+            meshCollider = std::make_unique<MeshCollider>();
+            meshCollider->m_scale = sycl::vec<float, 4>(mesh_scale, -mesh_scale, mesh_scale, 1.0f);
+            meshCollider->m_offset = sycl::vec<float, 4>(0.0f, eu.m_floorY, 0.0f, 0.0f);
+            meshCollider->load(colliderMesh->m_tris, colliderMesh->m_triangleCount);
+            eu.m_mesh = meshCollider->view();
+            std::cout << "colliding with " << meshCollider->size() << " triangles\n";
+        }
+        // the collider keeps its own copy
+        colliderMesh.reset();
+    }
+    std::unique_ptr<SimLod> lod;
+    if(sim_lod)
+    {
+        lod = std::make_unique<SimLod>(system.size);
+        lod->m_distance = lod_distance;
+        eu.m_lod = lod->view();
+    }
+    std::unique_ptr<ChainUpdater> chain;
+    if(use_chain)
+    {
+        chain = std::make_unique<ChainUpdater>();
+        chain->m_seed = seed;
+        chain->m_preset = chain_preset;
+        // a few strong ones, all in the kernel arguments
+        for(unsigned int i = 0; chain_preset == PRESET_ATTRACT && i < ATTRACTOR_INLINE; i++)
+        {
+            sycl::vec<float, 4> u = philox_randf(seed, i, 0, STREAM_BULK);
+            chain->add(sycl::vec<float, 4>(u.x() * 600.0f - 300.0f, u.y() * 900.0f, u.z() * 600.0f - 300.0f, u.w() < 0.7f ? 8000.0f : -8000.0f));
+        }
+    }
+    std::unique_ptr<SphSolver> sph;
+    if(sph_mode)
+    {
+        sph = std::make_unique<SphSolver>();
+        // the fluid brings its own gravity, no random gusts and a soft floor
+        eu.acc_min = eu.acc_max = 0.0f;
+        eu.m_bounceFactor = 0.2f;
+    }
+    BudgetController budget(system.size);
+    budget.m_targetMs = target_ms;
+    budget.m_scaleRender = budget_render;
+    // built only when asked for, the request buffer is a few megabytes
+    std::unique_ptr<SplashEmitter> splash;
+    if(splashes)
+    {
+        splash = std::make_unique<SplashEmitter>();
+        splash->m_seed = seed;
+        eu.m_splash = splash->sink();
+    }
     // size_t *to_kill = sycl::malloc_device<size_t>(system.size, system.q);
     // size_t *to_kill_host = sycl::malloc_host<size_t>(system.size, system.q);
     // const size_t thread_count = system.q.get_device().get_info<sycl::info::device::max_compute_units>() * 128;
@@ -137,14 +743,99 @@ int main(int arg_num, char **args)
         BeginDrawing();
         double dt = GetFrameTime();
         ClearBackground(RAYWHITE);
+        budget.begin(STAGE_RENDER);
         renderer.draw(dt, canvas, tex, color, screenWidth, screenHeight, system, system.q);
-        eu.update(dt, system);
-        emit(dt, system, gen, emmit_count);
+        budget.end(STAGE_RENDER);
+        budget.begin(STAGE_UPDATE);
+        if(sph)
+        {
+            sph->m_floorY = eu.m_floorY;
+            sph->update(dt, system);
+        }
+        if(meshCollider && meshCollider->size() > 0)
+        {
+            // a slow turn, the tree keeps its topology and only the boxes move
+            meshCollider->m_rotation = quat_axis_angle(sycl::vec<float, 4>(0.0f, 1.0f, 0.0f, 0.0f), 0.3f * (float)GetTime());
+            meshCollider->refit();
+        }
+        if(lod)
+        {
+            lod->classify(dt, renderer.view_proj(), renderer.eye(), system);
+            eu.m_lod = lod->view();
+        }
+        if(chain)
+        {
+            // sph and the keyboard set these on eu, the chain follows it
+            chain->m_floorY = eu.m_floorY;
+            chain->m_bounceFactor = eu.m_bounceFactor;
+            chain->m_accMin = eu.acc_min;
+            chain->m_accMax = eu.acc_max;
+            chain->update(dt, system);
+        }
+        else
+            eu.update(dt, system);
+        if(splash)
+            splash->generate(system);
+        budget.end(STAGE_UPDATE);
+        budget.begin(STAGE_EMIT);
+        const size_t rate = (size_t)(emmit_count * budget.m_emitScale);
+        // over the cap nothing is emitted, the pool drains as particles die
+        if(system.m_countAlive < budget.m_particleCap)
+        {
+            if(table)
+            {
+                table->m_rateScale = budget.m_emitScale;
+                table->generate(system, dt);
+            }
+            else if(curveGen)
+            {
+                static_cast<BoxPos &>(*curveGen) = gen;
+                static_cast<BoxVel &>(*curveGen) = gen;
+                curveGen->m_rateScale = budget.m_emitScale;
+                curveGen->generate_curve(system, dt);
+            }
+            else if(meshGen)
+            {
+                // the keyboard edits gen, the mesh emitter follows it
+                static_cast<BoxVel &>(*meshGen) = gen;
+                static_cast<RangeColor &>(*meshGen) = gen;
+                static_cast<RangeTime &>(*meshGen) = gen;
+                emit(dt, system, *meshGen, rate, budget.m_particleCap);
+            }
+            else if(imageGen)
+            {
+                static_cast<BoxVel &>(*imageGen) = gen;
+                static_cast<RangeTime &>(*imageGen) = gen;
+                emit(dt, system, *imageGen, rate, budget.m_particleCap);
+            }
+            else
+                emit(dt, system, gen, rate, budget.m_particleCap);
+        }
+        budget.end(STAGE_EMIT);
+        if(target_ms > 0.0)
+        {
+            budget.frame(dt);
+            renderer.m_renderScale = budget.m_renderScale;
+        }
         DrawText("Particle System", 10, 10, 20, DARKGRAY);
         DrawText("Press ESC to exit", 10, 30, 20, DARKGRAY);
         DrawText(TextFormat("Alive particles : %d", system.m_countAlive), 10, 50, 20, DARKGRAY);
         DrawText(TextFormat("Total particles: %d", system.size), 10, 70, 20, DARKGRAY);
         DrawText(TextFormat("FPS: %d", GetFPS()), 10, 90, 20, DARKGRAY);
+        if(table)
+            DrawText(TextFormat("Emitters: %d", (int)table->size()), 200, 90, 20, DARKGRAY);
+        if(target_ms > 0.0)
+        {
+            DrawText(TextFormat("Budget: %.1f ms target, %.1f ms frame (render %.1f, update %.1f, emit %.1f)", budget.m_targetMs, budget.m_frameMs,
+                                budget.m_stageMs[STAGE_RENDER], budget.m_stageMs[STAGE_UPDATE], budget.m_stageMs[STAGE_EMIT]), 400, 10, 20, DARKGRAY);
+            DrawText(TextFormat("emission x%.2f, cap %d, render x%.2f", budget.m_emitScale, (int)budget.m_particleCap, budget.m_renderScale), 400, 30, 20, DARKGRAY);
+            DrawText(TextFormat("last change: %s", budget.m_lastDecision.c_str()), 400, 50, 20, DARKGRAY);
+        }
+        if(lod)
+        {
+            lod->count_levels(system.m_highWater);
+            DrawText(TextFormat("LOD drops: %d full, %d 1/2, %d 1/4, %d 1/8", lod->m_counts[0], lod->m_counts[1], lod->m_counts[2], lod->m_counts[3]), 10, 110, 20, DARKGRAY);
+        }
         input.processInput(gen, eu, emmit_count);
         EndDrawing();
     }
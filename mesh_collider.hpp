@@ -0,0 +1,372 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "parallel_sycl_sorting.hpp"
+#include "barnes_hut.hpp"
+#include "colliders.hpp"
+
+// exact collisions against a triangle mesh through a linear BVH built on the
+// device (Karras 2012, "maximizing parallelism in the construction of BVHs"):
+//  - the triangles are placed with m_scale, m_rotation and m_offset
+//  - 30 bit morton codes of their centroids, radix sorted with the triangle
+//  - every internal node finds its key range and split from the sorted codes
+//    alone, all of them in one pass (n - 1 internal nodes, n leaves)
+//  - boxes bottom-up: each leaf walks toward the root, the second child to
+//    arrive at a node merges both boxes and keeps going
+// refit() only repeats the placement and the boxes, enough for a mesh that
+// moves or bends a little every frame. a particle tests the segment it moved
+// along this frame against the tree, so fast drops can't skip a thin wall.
+
+const unsigned int BVH_NONE = 0xffffffffu;
+const unsigned int BVH_STACK = 64;
+const size_t BVH_GROUP = 256;
+
+class BvhNode
+{
+public:
+    sycl::vec<float, 4> lo;
+    sycl::vec<float, 4> hi;
+    unsigned int left;   // internal: child nodes. leaf: left is the triangle
+    unsigned int right;
+    unsigned int parent;
+    unsigned int pad;
+};
+
+// device side, copy it into a kernel. nodes [0, n - 1) are internal, the
+// root is 0, nodes [n - 1, 2n - 1) are the leaves
+class MeshView
+{
+public:
+    const BvhNode *m_nodes{ nullptr };
+    const sycl::vec<float, 4> *m_tris{ nullptr }; // placed, 3 corners per triangle
+    unsigned int m_triangleCount{ 0 };
+
+    bool valid() const { return m_nodes != nullptr && m_triangleCount > 0; }
+
+    // first hit of the segment from -> to, t along it and the face normal
+    // turned toward from
+    bool segment(const sycl::vec<float, 4> &from, const sycl::vec<float, 4> &to, float &t, sycl::vec<float, 4> &normal) const
+    {
+        sycl::vec<float, 4> dir = to - from;
+        dir.w() = 0.0f;
+        const sycl::vec<float, 4> inv(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z(), 0.0f);
+        const unsigned int firstLeaf = m_triangleCount - 1;
+        float best = 1.0f;
+        unsigned int hitTri = BVH_NONE;
+        unsigned int stack[BVH_STACK];
+        unsigned int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            unsigned int node = stack[--top];
+            const BvhNode &nd = m_nodes[node];
+            // slab test, fmin / fmax drop the nans of axis parallel segments
+            float t0 = 0.0f, t1 = best;
+            for (int a = 0; a < 3; ++a)
+            {
+                float ta = (nd.lo[a] - from[a]) * inv[a];
+                float tb = (nd.hi[a] - from[a]) * inv[a];
+                t0 = sycl::fmax(t0, sycl::fmin(ta, tb));
+                t1 = sycl::fmin(t1, sycl::fmax(ta, tb));
+            }
+            if (t0 > t1) continue;
+            if (node >= firstLeaf)
+            {
+                float th;
+                if (triangle(nd.left, from, dir, th) && th < best)
+                {
+                    best = th;
+                    hitTri = nd.left;
+                }
+                continue;
+            }
+            if (top + 2 > BVH_STACK) continue; // deeper than a sane tree, give up on the branch
+            stack[top++] = nd.left;
+            stack[top++] = nd.right;
+        }
+        if (hitTri == BVH_NONE) return false;
+        t = best;
+        sycl::vec<float, 4> a = m_tris[hitTri * 3], b = m_tris[hitTri * 3 + 1], c = m_tris[hitTri * 3 + 2];
+        sycl::vec<float, 3> n = sycl::cross(sycl::vec<float, 3>(b.x() - a.x(), b.y() - a.y(), b.z() - a.z()),
+                                            sycl::vec<float, 3>(c.x() - a.x(), c.y() - a.y(), c.z() - a.z()));
+        normal = sycl::vec<float, 4>(n.x(), n.y(), n.z(), 0.0f);
+        normal /= sycl::length(normal);
+        if (sycl::dot(normal, dir) > 0.0f) normal = -normal;
+        return true;
+    }
+
+private:
+    // moller-trumbore, t in [0, 1] along dir
+    bool triangle(unsigned int tri, const sycl::vec<float, 4> &from, const sycl::vec<float, 4> &dir, float &t) const
+    {
+        sycl::vec<float, 4> a = m_tris[tri * 3], b = m_tris[tri * 3 + 1], c = m_tris[tri * 3 + 2];
+        sycl::vec<float, 3> e1(b.x() - a.x(), b.y() - a.y(), b.z() - a.z());
+        sycl::vec<float, 3> e2(c.x() - a.x(), c.y() - a.y(), c.z() - a.z());
+        sycl::vec<float, 3> d(dir.x(), dir.y(), dir.z());
+        sycl::vec<float, 3> pv = sycl::cross(d, e2);
+        float det = sycl::dot(e1, pv);
+        if (sycl::fabs(det) < 1e-12f) return false;
+        float invDet = 1.0f / det;
+        sycl::vec<float, 3> tv(from.x() - a.x(), from.y() - a.y(), from.z() - a.z());
+        float u = sycl::dot(tv, pv) * invDet;
+        if (u < 0.0f || u > 1.0f) return false;
+        sycl::vec<float, 3> qv = sycl::cross(tv, e1);
+        float v = sycl::dot(d, qv) * invDet;
+        if (v < 0.0f || u + v > 1.0f) return false;
+        t = sycl::dot(e2, qv) * invDet;
+        return t >= 0.0f && t <= 1.0f;
+    }
+};
+
+class MeshCollider
+{
+public:
+    sycl::vec<float, 4> m_scale{ 1.0f, 1.0f, 1.0f, 1.0f };
+    sycl::vec<float, 4> m_rotation{ 0.0f, 0.0f, 0.0f, 1.0f }; // unit quaternion
+    sycl::vec<float, 4> m_offset{ 0.0f };
+    sycl::queue q;
+private:
+    size_t m_count{ 0 };
+    sycl::vec<float, 4> *m_local{ nullptr }; // as loaded
+    sycl::vec<float, 4> *m_world{ nullptr }; // placed
+    BvhNode *m_nodes{ nullptr };
+    unsigned int *m_keys{ nullptr };
+    unsigned int *m_values{ nullptr };
+    unsigned int *m_tmpKeys{ nullptr };
+    unsigned int *m_tmpValues{ nullptr };
+    unsigned int *m_hist{ nullptr };
+    unsigned int *m_scratch{ nullptr };
+    unsigned int *m_visits{ nullptr };
+    float *m_bounds{ nullptr };
+public:
+    MeshCollider(): q(sycl::gpu_selector_v)
+    {
+        m_bounds = sycl::malloc_device<float>(6, q);
+    }
+    MeshCollider(const MeshCollider &) = delete;
+    MeshCollider &operator=(const MeshCollider &) = delete;
+    ~MeshCollider()
+    {
+        release();
+        sycl::free(m_bounds, q);
+    }
+
+    size_t size() const { return m_count; }
+
+    MeshView view() const
+    {
+        return MeshView{ m_nodes, m_world, (unsigned int)m_count };
+    }
+
+    // tris: 3 corners per triangle in device memory (MeshSurface::m_tris),
+    // copied, the caller can free them
+    void load(const sycl::vec<float, 4> *tris, size_t triangleCount)
+    {
+        release();
+        m_count = triangleCount;
+        if (m_count == 0) return;
+        const size_t n = m_count;
+        m_local = sycl::malloc_device<sycl::vec<float, 4>>(n * 3, q);
+        m_world = sycl::malloc_device<sycl::vec<float, 4>>(n * 3, q);
+        m_nodes = sycl::malloc_device<BvhNode>(2 * n - 1, q);
+        m_keys = sycl::malloc_device<unsigned int>(n, q);
+        m_values = sycl::malloc_device<unsigned int>(n, q);
+        m_tmpKeys = sycl::malloc_device<unsigned int>(n, q);
+        m_tmpValues = sycl::malloc_device<unsigned int>(n, q);
+        m_hist = sycl::malloc_device<unsigned int>(device_radix_hist(n), q);
+        m_scratch = sycl::malloc_device<unsigned int>(device_scan_scratch(device_radix_hist(n)), q);
+        m_visits = sycl::malloc_device<unsigned int>(n, q);
+        q.memcpy(m_local, tris, sizeof(sycl::vec<float, 4>) * n * 3).wait();
+        build();
+    }
+
+    // full rebuild, for big changes of m_scale / m_rotation / m_offset
+    void build()
+    {
+        if (m_count == 0) return;
+        place();
+        const size_t n = m_count;
+        const sycl::vec<float, 4> *world = m_world;
+        float *bounds = m_bounds;
+        unsigned int *keys = m_keys;
+        unsigned int *values = m_values;
+
+        // centroid bounds, a reduction per group and one atomic per group
+        const float inf = std::numeric_limits<float>::infinity();
+        const float init[6] = { inf, inf, inf, -inf, -inf, -inf };
+        q.memcpy(bounds, init, sizeof(init)).wait();
+        const size_t global = (n + BVH_GROUP - 1) / BVH_GROUP * BVH_GROUP;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::nd_range<1>(global, BVH_GROUP), [=](sycl::nd_item<1> it){
+                size_t t = it.get_global_id(0);
+                bool on = t < n;
+                sycl::vec<float, 4> c = on ? (world[t * 3] + world[t * 3 + 1] + world[t * 3 + 2]) / 3.0f : sycl::vec<float, 4>(0.0f);
+                auto g = it.get_group();
+                float lo[3], hi[3];
+                for (int a = 0; a < 3; ++a)
+                {
+                    lo[a] = sycl::reduce_over_group(g, on ? c[a] : inf, sycl::minimum<float>());
+                    hi[a] = sycl::reduce_over_group(g, on ? c[a] : -inf, sycl::maximum<float>());
+                }
+                if (it.get_local_id(0) != 0) return;
+                for (int a = 0; a < 3; ++a)
+                {
+                    sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device> lo_ref(bounds[a]);
+                    sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device> hi_ref(bounds[3 + a]);
+                    lo_ref.fetch_min(lo[a]);
+                    hi_ref.fetch_max(hi[a]);
+                }
+            });
+        }).wait();
+
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx_d){
+                size_t t = idx_d.get(0);
+                sycl::vec<float, 4> c = (world[t * 3] + world[t * 3 + 1] + world[t * 3 + 2]) / 3.0f;
+                unsigned int code = 0;
+                for (int a = 0; a < 3; ++a)
+                {
+                    float extent = bounds[3 + a] - bounds[a];
+                    float f = extent > 0.0f ? (c[a] - bounds[a]) / extent : 0.0f;
+                    unsigned int cell = (unsigned int)sycl::clamp(f * 1024.0f, 0.0f, 1023.0f);
+                    code |= morton_spread(cell) << a;
+                }
+                keys[t] = code;
+                values[t] = (unsigned int)t;
+            });
+        }).wait();
+        device_radix_sort(q, m_keys, m_values, n, m_tmpKeys, m_tmpValues, m_hist, m_scratch, 30);
+
+        BvhNode *nodes = m_nodes;
+        const int count = (int)n;
+        // leaves, then the internal nodes from the sorted codes
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx_d){
+                size_t k = idx_d.get(0);
+                BvhNode &leaf = nodes[n - 1 + k];
+                leaf.left = values[k];
+                leaf.right = BVH_NONE;
+                leaf.parent = BVH_NONE;
+            });
+        }).wait();
+        if (n > 1)
+        {
+            q.submit([&](sycl::handler &h){
+                h.parallel_for(sycl::range<1>(n - 1), [=](sycl::id<1> idx_d){
+                    const int i = (int)idx_d.get(0);
+                    // common prefix of codes i and j, equal codes fall back to the indices
+                    auto delta = [&](int j) -> int {
+                        if (j < 0 || j >= count) return -1;
+                        unsigned int x = keys[i] ^ keys[j];
+                        return x != 0 ? (int)sycl::clz(x) : 32 + (int)sycl::clz((unsigned int)(i ^ j));
+                    };
+                    const int d = delta(i + 1) - delta(i - 1) > 0 ? 1 : -1;
+                    const int dmin = delta(i - d);
+                    int lmax = 2;
+                    while (delta(i + lmax * d) > dmin)
+                        lmax *= 2;
+                    int l = 0;
+                    for (int t = lmax / 2; t >= 1; t /= 2)
+                        if (delta(i + (l + t) * d) > dmin)
+                            l += t;
+                    const int j = i + l * d;
+                    const int dnode = delta(j);
+                    int s = 0;
+                    int t = l;
+                    do
+                    {
+                        t = (t + 1) >> 1;
+                        if (delta(i + (s + t) * d) > dnode)
+                            s += t;
+                    } while (t > 1);
+                    const int gamma = i + s * d + sycl::min(d, 0);
+                    const unsigned int left = sycl::min(i, j) == gamma ? (unsigned int)(count - 1 + gamma) : (unsigned int)gamma;
+                    const unsigned int right = sycl::max(i, j) == gamma + 1 ? (unsigned int)(count - 1 + gamma + 1) : (unsigned int)(gamma + 1);
+                    nodes[i].left = left;
+                    nodes[i].right = right;
+                    nodes[left].parent = (unsigned int)i;
+                    nodes[right].parent = (unsigned int)i;
+                    if (i == 0) nodes[0].parent = BVH_NONE;
+                });
+            }).wait();
+        }
+        boxes();
+    }
+
+    // places the triangles again and updates the boxes, the tree stays
+    void refit()
+    {
+        if (m_count == 0) return;
+        place();
+        boxes();
+    }
+
+private:
+    void place()
+    {
+        const sycl::vec<float, 4> scale = m_scale;
+        const sycl::vec<float, 4> rotation = m_rotation;
+        const sycl::vec<float, 4> offset = m_offset;
+        const sycl::vec<float, 4> *local = m_local;
+        sycl::vec<float, 4> *world = m_world;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(m_count * 3), [=](sycl::id<1> idx_d){
+                size_t v = idx_d.get(0);
+                sycl::vec<float, 4> p = local[v] * scale;
+                p = quat_rotate(rotation, p) + offset;
+                p.w() = 0.0f;
+                world[v] = p;
+            });
+        }).wait();
+    }
+
+    void boxes()
+    {
+        const size_t n = m_count;
+        const sycl::vec<float, 4> *world = m_world;
+        BvhNode *nodes = m_nodes;
+        unsigned int *visits = m_visits;
+        q.memset(visits, 0, sizeof(unsigned int) * n).wait();
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx_d){
+                unsigned int node = (unsigned int)(n - 1 + idx_d.get(0));
+                unsigned int tri = nodes[node].left;
+                sycl::vec<float, 4> a = world[tri * 3], b = world[tri * 3 + 1], c = world[tri * 3 + 2];
+                nodes[node].lo = sycl::min(a, sycl::min(b, c));
+                nodes[node].hi = sycl::max(a, sycl::max(b, c));
+                node = nodes[node].parent;
+                while (node != BVH_NONE)
+                {
+                    // the first child to get here stops, its box is read by the second
+                    sycl::atomic_ref<unsigned int, sycl::memory_order::acq_rel, sycl::memory_scope::device> visit_ref(visits[node]);
+                    if (visit_ref.fetch_add(1u) == 0) return;
+                    const BvhNode &l = nodes[nodes[node].left];
+                    const BvhNode &r = nodes[nodes[node].right];
+                    nodes[node].lo = sycl::min(l.lo, r.lo);
+                    nodes[node].hi = sycl::max(l.hi, r.hi);
+                    node = nodes[node].parent;
+                }
+            });
+        }).wait();
+    }
+
+    void release()
+    {
+        if (m_local) sycl::free(m_local, q);
+        if (m_world) sycl::free(m_world, q);
+        if (m_nodes) sycl::free(m_nodes, q);
+        if (m_keys) sycl::free(m_keys, q);
+        if (m_values) sycl::free(m_values, q);
+        if (m_tmpKeys) sycl::free(m_tmpKeys, q);
+        if (m_tmpValues) sycl::free(m_tmpValues, q);
+        if (m_hist) sycl::free(m_hist, q);
+        if (m_scratch) sycl::free(m_scratch, q);
+        if (m_visits) sycl::free(m_visits, q);
+        m_local = m_world = nullptr;
+        m_nodes = nullptr;
+        m_keys = m_values = m_tmpKeys = m_tmpValues = m_hist = m_scratch = m_visits = nullptr;
+        m_count = 0;
+    }
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <iostream>
+#include "./include/raylib.h"
+#include "generator.hpp"
+#include "alias_table.hpp"
+
+// triangles of a raylib mesh kept in device memory, with an alias table
+// weighted by triangle area so every point of the surface is equally likely
+class MeshSurface
+{
+public:
+    sycl::vec<float, 4> *m_tris{ nullptr }; // 3 corners per triangle
+    size_t m_triangleCount{ 0 };
+    AliasTable m_alias;
+    sycl::queue q;
+public:
+    MeshSurface(): q(sycl::gpu_selector_v) {}
+    MeshSurface(const MeshSurface &) = delete;
+    MeshSurface &operator=(const MeshSurface &) = delete;
+    ~MeshSurface()
+    {
+        if (m_tris) sycl::free(m_tris, q);
+    }
+
+    // every mesh of the model, in model space
+    bool load(const char *path)
+    {
+        // LoadModel hands back a default cube for a file it cannot read
+        if (!FileExists(path))
+        {
+            std::cout << "could not load mesh: " << path << "\n";
+            return false;
+        }
+        Model model = LoadModel(path);
+        if (model.meshCount == 0)
+        {
+            std::cout << "could not load mesh: " << path << "\n";
+            return false;
+        }
+        std::vector<sycl::vec<float, 4>> tris;
+        for (int m = 0; m < model.meshCount; ++m)
+            append(model.meshes[m], tris);
+        UnloadModel(model);
+        return upload(tris);
+    }
+
+    bool load(const Mesh &mesh)
+    {
+        std::vector<sycl::vec<float, 4>> tris;
+        append(mesh, tris);
+        return upload(tris);
+    }
+
+private:
+    static void append(const Mesh &mesh, std::vector<sycl::vec<float, 4>> &tris)
+    {
+        if (mesh.vertices == nullptr) return;
+        for (int t = 0; t < mesh.triangleCount; ++t)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                int v = mesh.indices ? mesh.indices[t * 3 + c] : t * 3 + c;
+                tris.push_back(sycl::vec<float, 4>(mesh.vertices[v * 3 + 0], mesh.vertices[v * 3 + 1], mesh.vertices[v * 3 + 2], 1.0f));
+            }
+        }
+    }
+
+    bool upload(const std::vector<sycl::vec<float, 4>> &tris)
+    {
+        size_t count = tris.size() / 3;
+        std::vector<float> areas(count);
+        for (size_t t = 0; t < count; ++t)
+        {
+            sycl::vec<float, 4> e0 = tris[t * 3 + 1] - tris[t * 3];
+            sycl::vec<float, 4> e1 = tris[t * 3 + 2] - tris[t * 3];
+            areas[t] = 0.5f * sycl::length(sycl::cross(sycl::vec<float, 3>(e0.x(), e0.y(), e0.z()), sycl::vec<float, 3>(e1.x(), e1.y(), e1.z())));
+        }
+        if (!m_alias.build(areas))
+        {
+            std::cout << "mesh has no surface to emit from\n";
+            return false;
+        }
+        if (m_tris) sycl::free(m_tris, q);
+        m_tris = sycl::malloc_device<sycl::vec<float, 4>>(tris.size(), q);
+        q.memcpy(m_tris, tris.data(), sizeof(sycl::vec<float, 4>) * tris.size()).wait();
+        m_triangleCount = count;
+        return true;
+    }
+};
+
+// spawn component: a point on the mesh surface, picked in O(1) through the
+// area alias table then uniformly inside the triangle. the mesh is placed at
+// m_pos and scaled by m_scale. without a mesh it falls back to m_pos.
+class MeshSurfacePos
+{
+public:
+    const sycl::vec<float, 4> *m_tris{ nullptr };
+    AliasView m_triAlias;
+    sycl::vec<float, 4> m_pos{ 0.0f };
+    float m_scale{ 1.0f };
+
+    void attach(const MeshSurface &surface)
+    {
+        m_tris = surface.m_tris;
+        m_triAlias = surface.m_alias.view();
+    }
+
+    void spawn(Particle &pt, const SpawnCtx &ctx) const
+    {
+        pt.pos = m_pos;
+        pt.pos.w() = 1.0f;
+        if (m_tris == nullptr) return;
+        sycl::vec<float, 4> u = ctx.rand(STREAM_POS);
+        unsigned int t = m_triAlias.sample(u.x(), u.y());
+        // uniform barycentric coordinates
+        float su = sycl::sqrt(u.z());
+        float b0 = 1.0f - su;
+        float b1 = u.w() * su;
+        float b2 = 1.0f - b0 - b1;
+        sycl::vec<float, 4> p = m_tris[t * 3] * b0 + m_tris[t * 3 + 1] * b1 + m_tris[t * 3 + 2] * b2;
+        pt.pos += m_scale * p;
+        pt.pos.w() = 1.0f;
+    }
+};
+
+using MeshGen = Emitter<MeshSurfacePos, BoxVel, RangeColor, RangeTime>;
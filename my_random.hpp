@@ -18,3 +18,126 @@ sycl::vec<int, 4> random_range(sycl::vec<int, 4> min, sycl::vec<int, 4> max, uns
 extern SYCL_EXTERNAL 
 #endif
 sycl::vec<float, 4> random_rangef(sycl::vec<float, 4> min, sycl::vec<float, 4> max, unsigned int time);
+
+// counter-based generator (Philox4x32-10, Salmon et al. 2011).
+// no state: the output is a pure function of (counter, key), so any work-item
+// can draw its numbers directly without seeding or sharing anything.
+inline sycl::vec<unsigned int, 4> philox4x32(sycl::vec<unsigned int, 4> ctr, sycl::vec<unsigned int, 2> key)
+{
+    const unsigned int M0 = 0xD2511F53U;
+    const unsigned int M1 = 0xCD9E8D57U;
+    const unsigned int W0 = 0x9E3779B9U;
+    const unsigned int W1 = 0xBB67AE85U;
+    unsigned int c0 = ctr.x(), c1 = ctr.y(), c2 = ctr.z(), c3 = ctr.w();
+    unsigned int k0 = key.x(), k1 = key.y();
+    for (int round = 0; round < 10; ++round)
+    {
+        unsigned long long p0 = (unsigned long long)M0 * c0;
+        unsigned long long p1 = (unsigned long long)M1 * c2;
+        unsigned int hi0 = (unsigned int)(p0 >> 32), lo0 = (unsigned int)p0;
+        unsigned int hi1 = (unsigned int)(p1 >> 32), lo1 = (unsigned int)p1;
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += W0;
+        k1 += W1;
+    }
+    return sycl::vec<unsigned int, 4>(c0, c1, c2, c3);
+}
+
+// philox streams: every consumer of random numbers gets its own so that two
+// users with the same (seed, id, frame) never see the same values
+enum RandomStream : unsigned int
+{
+    STREAM_POS,
+    STREAM_START_COL,
+    STREAM_END_COL,
+    STREAM_VEL,
+    STREAM_TIME,
+    STREAM_GLOBAL_ACC,
+    STREAM_HALTON_SCRAMBLE,
+    STREAM_SPLASH_VEL,
+    STREAM_SPLASH_TIME,
+    STREAM_BULK, // RngStream, the frame word picks the channel
+    STREAM_WIND, // WindGrid gusts, the frame word is the gust's epoch
+    STREAM_CURL, // CurlNoiseVolume lattice gradients, the frame word picks the octave and axis
+};
+
+// four independent 32 bit values for (seed, particle id, frame, stream)
+inline sycl::vec<unsigned int, 4> philox_rand(unsigned long long seed, unsigned long long id, unsigned int frame, unsigned int stream)
+{
+    return philox4x32(sycl::vec<unsigned int, 4>((unsigned int)id, (unsigned int)(id >> 32), frame, stream),
+                      sycl::vec<unsigned int, 2>((unsigned int)seed, (unsigned int)(seed >> 32)));
+}
+
+// uniform floats in [0, 1), the top 24 bits fill the float mantissa exactly
+inline sycl::vec<float, 4> philox_randf(unsigned long long seed, unsigned long long id, unsigned int frame, unsigned int stream)
+{
+    sycl::vec<unsigned int, 4> r = philox_rand(seed, id, frame, stream);
+    sycl::vec<unsigned int, 4> top(r.x() >> 8, r.y() >> 8, r.z() >> 8, r.w() >> 8);
+    return top.convert<float>() * (1.0f / 16777216.0f);
+}
+
+inline sycl::vec<float, 4> philox_rangef(sycl::vec<float, 4> min, sycl::vec<float, 4> max, unsigned long long seed, unsigned long long id, unsigned int frame, unsigned int stream)
+{
+    return philox_randf(seed, id, frame, stream) * (max - min) + min;
+}
+
+inline float philox_rangef(float min, float max, unsigned long long seed, unsigned long long id, unsigned int frame, unsigned int stream)
+{
+    return philox_randf(seed, id, frame, stream).x() * (max - min) + min;
+}
+
+// low-discrepancy halton sequence for evenly covering emission volumes.
+// each dimension uses its own prime base and a digit scramble
+// d -> (d * mul + add) % base drawn from the seed, which breaks the
+// correlation between the higher dimensions of plain halton.
+const unsigned int HALTON_DIMS = 8;
+
+class HaltonScramble
+{
+public:
+    unsigned int mul[HALTON_DIMS];
+    unsigned int add[HALTON_DIMS];
+};
+
+inline unsigned int halton_base(unsigned int dim)
+{
+    const unsigned int primes[HALTON_DIMS] = { 2, 3, 5, 7, 11, 13, 17, 19 };
+    return primes[dim % HALTON_DIMS];
+}
+
+inline HaltonScramble halton_scramble(unsigned long long seed)
+{
+    HaltonScramble s;
+    for (unsigned int dim = 0; dim < HALTON_DIMS; ++dim)
+    {
+        unsigned int base = halton_base(dim);
+        sycl::vec<unsigned int, 4> r = philox_rand(seed, dim, 0, STREAM_HALTON_SCRAMBLE);
+        s.mul[dim] = 1 + r.x() % (base - 1); // never 0, the permutation stays a bijection
+        s.add[dim] = r.y() % base;
+    }
+    return s;
+}
+
+// value of the index-th point in [0, 1) along one dimension
+inline float halton(unsigned int index, unsigned int dim, const HaltonScramble &s)
+{
+    unsigned int base = halton_base(dim);
+    unsigned int mul = s.mul[dim % HALTON_DIMS];
+    unsigned int add = s.add[dim % HALTON_DIMS];
+    float inv_base = 1.0f / base;
+    float inv_bi = inv_base;
+    float result = 0.0f;
+    // run until the digits fall below float precision, zero digits past the
+    // end of the index are scrambled too
+    while (inv_bi > 1e-7f)
+    {
+        unsigned int digit = index % base;
+        index /= base;
+        result += (float)((digit * mul + add) % base) * inv_bi;
+        inv_bi *= inv_base;
+    }
+    return sycl::min(result, 0.99999994f);
+}
@@ -1,8 +1,160 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <utility>
+
+// device exclusive prefix sum of n unsigned ints, out[n] gets the total so
+// out needs n + 1 entries (in == out is fine). each work-group scans
+// SCAN_GROUP * SCAN_ITEMS consecutive values, their sums are scanned by a
+// single group in between. scratch needs device_scan_scratch(n) entries.
+const size_t SCAN_GROUP = 256;
+const size_t SCAN_ITEMS = 16;
+const size_t SCAN_BLOCK = SCAN_GROUP * SCAN_ITEMS;
+
+inline size_t device_scan_scratch(size_t n)
+{
+    return (n + SCAN_BLOCK - 1) / SCAN_BLOCK + 1;
+}
+
+inline void device_exclusive_scan(sycl::queue &q, const unsigned int *in, unsigned int *out, size_t n, unsigned int *scratch)
+{
+    const size_t blocks = (n + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    if (blocks == 0)
+    {
+        q.memset(out, 0, sizeof(unsigned int)).wait();
+        return;
+    }
+
+    // sum of every block
+    q.submit([&](sycl::handler &h){
+        h.parallel_for(sycl::nd_range<1>(blocks * SCAN_GROUP, SCAN_GROUP), [=](sycl::nd_item<1> it){
+            size_t first = it.get_group(0) * SCAN_BLOCK + it.get_local_id(0) * SCAN_ITEMS;
+            unsigned int sum = 0;
+            for (size_t i = first; i < first + SCAN_ITEMS && i < n; ++i)
+                sum += in[i];
+            sum = sycl::reduce_over_group(it.get_group(), sum, sycl::plus<unsigned int>());
+            if (it.get_local_id(0) == 0) scratch[it.get_group(0)] = sum;
+        });
+    }).wait();
+
+    // block offsets, one group walking the block sums
+    q.submit([&](sycl::handler &h){
+        h.parallel_for(sycl::nd_range<1>(SCAN_GROUP, SCAN_GROUP), [=](sycl::nd_item<1> it){
+            auto g = it.get_group();
+            size_t lid = it.get_local_id(0);
+            unsigned int running = 0;
+            for (size_t base = 0; base < blocks; base += SCAN_GROUP)
+            {
+                size_t i = base + lid;
+                unsigned int c = i < blocks ? scratch[i] : 0;
+                unsigned int s = sycl::exclusive_scan_over_group(g, c, sycl::plus<unsigned int>());
+                unsigned int total = sycl::reduce_over_group(g, c, sycl::plus<unsigned int>());
+                if (i < blocks) scratch[i] = running + s;
+                running += total;
+            }
+            if (lid == 0) scratch[blocks] = running;
+        });
+    }).wait();
+
+    // scan inside every block on top of its offset
+    q.submit([&](sycl::handler &h){
+        h.parallel_for(sycl::nd_range<1>(blocks * SCAN_GROUP, SCAN_GROUP), [=](sycl::nd_item<1> it){
+            size_t first = it.get_group(0) * SCAN_BLOCK + it.get_local_id(0) * SCAN_ITEMS;
+            unsigned int vals[SCAN_ITEMS];
+            unsigned int sum = 0;
+            for (size_t k = 0; k < SCAN_ITEMS; ++k)
+            {
+                vals[k] = first + k < n ? in[first + k] : 0;
+                sum += vals[k];
+            }
+            unsigned int running = scratch[it.get_group(0)] + sycl::exclusive_scan_over_group(it.get_group(), sum, sycl::plus<unsigned int>());
+            for (size_t k = 0; k < SCAN_ITEMS && first + k < n; ++k)
+            {
+                out[first + k] = running;
+                running += vals[k];
+            }
+            if (it.get_global_id(0) == 0) out[n] = scratch[blocks];
+        });
+    }).wait();
+}
+
 // #include <sycl/sycl.hpp>
 // #include <cmath>
 // #include <vector>
 // #include <algorithm>
 
+// stable device radix sort of unsigned int keys with their values, RADIX_BITS
+// per pass and `bits` key bits in total (the low ones). every pass: digit
+// histogram of each block, scan of the histograms laid out digit-major so
+// the scan gives every (digit, block) its output offset, then each work-item
+// scatters its own run in order. keys/values end up sorted in place, the
+// tmp buffers need n entries and hist device_radix_hist(n) entries.
+const unsigned int RADIX_BITS = 4;
+const unsigned int RADIX_DIGITS = 1u << RADIX_BITS;
+
+inline size_t device_radix_hist(size_t n)
+{
+    size_t blocks = (n + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    return blocks * RADIX_DIGITS + 1;
+}
+
+inline void device_radix_sort(sycl::queue &q, unsigned int *keys, unsigned int *values, size_t n,
+                              unsigned int *tmpKeys, unsigned int *tmpValues, unsigned int *hist, unsigned int *scratch,
+                              unsigned int bits = 32)
+{
+    const size_t blocks = (n + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    if (blocks == 0) return;
+    unsigned int *srcK = keys, *srcV = values, *dstK = tmpKeys, *dstV = tmpValues;
+    for (unsigned int shift = 0; shift < bits; shift += RADIX_BITS)
+    {
+        const unsigned int *inK = srcK;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::nd_range<1>(blocks * SCAN_GROUP, SCAN_GROUP), [=](sycl::nd_item<1> it){
+                size_t first = it.get_group(0) * SCAN_BLOCK + it.get_local_id(0) * SCAN_ITEMS;
+                unsigned int count[RADIX_DIGITS] = {};
+                for (size_t i = first; i < first + SCAN_ITEMS && i < n; ++i)
+                    ++count[(inK[i] >> shift) & (RADIX_DIGITS - 1)];
+                for (unsigned int d = 0; d < RADIX_DIGITS; ++d)
+                {
+                    unsigned int total = sycl::reduce_over_group(it.get_group(), count[d], sycl::plus<unsigned int>());
+                    if (it.get_local_id(0) == 0) hist[d * blocks + it.get_group(0)] = total;
+                }
+            });
+        }).wait();
+
+        device_exclusive_scan(q, hist, hist, blocks * RADIX_DIGITS, scratch);
+
+        const unsigned int *inV = srcV;
+        unsigned int *outK = dstK, *outV = dstV;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::nd_range<1>(blocks * SCAN_GROUP, SCAN_GROUP), [=](sycl::nd_item<1> it){
+                size_t first = it.get_group(0) * SCAN_BLOCK + it.get_local_id(0) * SCAN_ITEMS;
+                unsigned int count[RADIX_DIGITS] = {};
+                for (size_t i = first; i < first + SCAN_ITEMS && i < n; ++i)
+                    ++count[(inK[i] >> shift) & (RADIX_DIGITS - 1)];
+                unsigned int offset[RADIX_DIGITS];
+                for (unsigned int d = 0; d < RADIX_DIGITS; ++d)
+                    offset[d] = hist[d * blocks + it.get_group(0)] + sycl::exclusive_scan_over_group(it.get_group(), count[d], sycl::plus<unsigned int>());
+                for (size_t i = first; i < first + SCAN_ITEMS && i < n; ++i)
+                {
+                    unsigned int d = (inK[i] >> shift) & (RADIX_DIGITS - 1);
+                    outK[offset[d]] = inK[i];
+                    outV[offset[d]] = inV[i];
+                    ++offset[d];
+                }
+            });
+        }).wait();
+        std::swap(srcK, dstK);
+        std::swap(srcV, dstV);
+    }
+    // an odd number of passes leaves the result in tmp
+    if (srcK != keys)
+    {
+        q.memcpy(keys, srcK, sizeof(unsigned int) * n);
+        q.memcpy(values, srcV, sizeof(unsigned int) * n);
+        q.wait();
+    }
+}
+
 // // Helper function for parallel merge - fixed version
 // template <typename T>
 // void parallel_merge(sycl::queue &q, T *start, size_t mid, size_t size) {
@@ -12,7 +12,7 @@ public:
              sycl::vec<float, 4> velocity, sycl::vec<float, 4> acceleration,
              sycl::vec<float, 4> timeToLive)
         : pos(position), col(color), startCol(startColor), endCol(endColor),
-          vel(velocity), acc(acceleration), time(timeToLive), alive(true) {}
+          vel(velocity), acc(acceleration), time(timeToLive) {}
     Particle(Particle &&other) = default;
     Particle(const Particle &other)
     {
@@ -23,7 +23,6 @@ public:
         vel = other.vel;
         acc = other.acc;
         time = other.time;
-        alive = other.alive;
     }
     Particle &operator=(Particle &&other) = default;
     Particle &operator=(const Particle &other)
@@ -35,7 +34,6 @@ public:
         vel = other.vel;
         acc = other.acc;
         time = other.time;
-        alive = other.alive;
         return *this;
     }
     ~Particle() = default;
@@ -47,7 +45,6 @@ public:
     sycl::vec<float, 4> vel;
     sycl::vec<float, 4> acc;
     sycl::vec<float, 4> time;
-    bool  alive;
 };
 
 
@@ -65,14 +62,27 @@ void swap(T &a, T &b)
 class Particle_system
 {
 public:
-    Particle_system(size_t p_count):  q(sycl::gpu_selector_v), m_countAlive(0){
+    // the device is for the headless tests, the simulator runs on the gpu
+    Particle_system(size_t p_count, const sycl::device &device = sycl::device(sycl::gpu_selector_v)):  q(device), m_countAlive(0){
+        // nothing is cleared here: slots (and their liveness) are only written
+        // once the generator hands them out, see grow()
         m_particle = sycl::malloc_device<Particle>(p_count, q);
-        q.memset(m_particle, 0, sizeof(Particle) * p_count).wait();
+        m_alive = sycl::malloc_device<unsigned char>(p_count, q);
         size = p_count;
     }
 
     ~Particle_system() {
         sycl::free(m_particle, q);
+        sycl::free(m_alive, q);
+    }
+
+    // reserves up to `count` never used slots past the high-water mark,
+    // returns how many were reserved, they start at the old m_highWater
+    size_t grow(size_t count)
+    {
+        size_t granted = std::min(count, size - m_highWater);
+        m_highWater += granted;
+        return granted;
     }
     
     void kill()
@@ -193,10 +203,12 @@ public:
     }
 
     Particle *m_particle;
+    unsigned char *m_alive; // 1 if the slot is live, only valid below m_highWater
     size_t size;
     sycl::queue q;
     // sycl::buffer<Particle, 1> buf;
     size_t m_countAlive{ 0 };
+    size_t m_highWater{ 0 }; // slots at or past this index were never handed out
 };
 
 
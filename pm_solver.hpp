@@ -0,0 +1,264 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <cmath>
+#include "particle.hpp"
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// particle-mesh gravity: O(N + G log G) instead of the tree walk, for pools
+// too big for BarnesHut. every update():
+//  - cloud-in-cell deposit of the particle masses on an m_res^3 grid, into
+//    m_copies private grids picked by slot so dense spots don't fight over
+//    the same atomics, then summed into density
+//  - 3D FFT, one axis at a time, a work-group per line in local memory
+//  - poisson solve in k-space with the eigenvalues of the discrete laplacian,
+//    the mean density (k = 0) drops out
+//  - inverse FFT, central differences for the acceleration at every node
+//  - cloud-in-cell gather back to the particles, vel += dt * a
+// the box is periodic: mass near a face also pulls from the opposite one, so
+// keep the box about twice as big as the rain. particles outside it neither
+// deposit nor feel anything.
+
+const size_t PM_MAX_RES = 256; // a line has to fit in one work-group (res / 2 items)
+
+class PmSolver
+{
+public:
+    float m_G{ 1000.0f };
+    float m_particleMass{ 1.0f };
+    sycl::vec<float, 4> m_origin{ -1000.0f, -500.0f, -1000.0f, 0.0f }; // lowest corner of the cubic box
+    float m_size{ 2000.0f };
+    sycl::queue q;
+private:
+    size_t m_res;
+    size_t m_copies;
+    float *m_deposit{ nullptr };               // m_copies grids of m_res^3
+    sycl::vec<float, 2> *m_field{ nullptr };   // complex, density then potential
+    sycl::vec<float, 4> *m_force{ nullptr };   // acceleration per node
+public:
+    // res is rounded up to a power of two in [8, PM_MAX_RES]
+    PmSolver(size_t res = 128, size_t copies = 4): q(sycl::gpu_selector_v), m_copies(copies < 1 ? 1 : copies)
+    {
+        m_res = 8;
+        while (m_res < res && m_res < PM_MAX_RES) m_res <<= 1;
+        const size_t cells = m_res * m_res * m_res;
+        m_deposit = sycl::malloc_device<float>(cells * m_copies, q);
+        m_field = sycl::malloc_device<sycl::vec<float, 2>>(cells, q);
+        m_force = sycl::malloc_device<sycl::vec<float, 4>>(cells, q);
+    }
+    PmSolver(const PmSolver &) = delete;
+    PmSolver &operator=(const PmSolver &) = delete;
+    ~PmSolver()
+    {
+        sycl::free(m_deposit, q);
+        sycl::free(m_field, q);
+        sycl::free(m_force, q);
+    }
+
+    size_t res() const { return m_res; }
+
+    void update(double dt, Particle_system &p)
+    {
+        const size_t endId = p.m_highWater;
+        if (endId == 0) return;
+        deposit(p);
+        fft(false);
+        solve();
+        fft(true);
+        gradient();
+        gather(dt, p);
+    }
+
+    // cell-centred cloud-in-cell weights: the 8 nodes around pos and their
+    // weights, false when pos is outside the box
+    static bool cic(const sycl::vec<float, 4> &pos, sycl::vec<float, 4> origin, float cell, size_t res,
+                    size_t nodes[8], float weights[8])
+    {
+        float fx = (pos.x() - origin.x()) / cell;
+        float fy = (pos.y() - origin.y()) / cell;
+        float fz = (pos.z() - origin.z()) / cell;
+        const float top = (float)res;
+        if (!(fx >= 0.0f && fx < top && fy >= 0.0f && fy < top && fz >= 0.0f && fz < top)) return false;
+        fx -= 0.5f; fy -= 0.5f; fz -= 0.5f;
+        int x = (int)sycl::floor(fx), y = (int)sycl::floor(fy), z = (int)sycl::floor(fz);
+        float tx = fx - x, ty = fy - y, tz = fz - z;
+        const size_t mask = res - 1; // periodic wrap across the faces
+        for (int c = 0; c < 8; ++c)
+        {
+            int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+            size_t i = (size_t)(x + dx) & mask, j = (size_t)(y + dy) & mask, k = (size_t)(z + dz) & mask;
+            nodes[c] = (k * res + j) * res + i;
+            weights[c] = (dx ? tx : 1.0f - tx) * (dy ? ty : 1.0f - ty) * (dz ? tz : 1.0f - tz);
+        }
+        return true;
+    }
+
+private:
+    void deposit(Particle_system &p)
+    {
+        const size_t endId = p.m_highWater;
+        const size_t res = m_res;
+        const size_t cells = res * res * res;
+        const size_t copies = m_copies;
+        const sycl::vec<float, 4> origin = m_origin;
+        const float cell = m_size / (float)m_res;
+        const float mass = m_particleMass;
+        float *dep = m_deposit;
+        sycl::vec<float, 2> *field = m_field;
+        const Particle *buf_acc = p.m_particle;
+        const unsigned char *alive_acc = p.m_alive;
+
+        q.memset(m_deposit, 0, sizeof(float) * cells * copies).wait();
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if (alive_acc[idx] == 0) return;
+                size_t nodes[8];
+                float weights[8];
+                if (!cic(buf_acc[idx].pos, origin, cell, res, nodes, weights)) return;
+                float *grid = dep + (idx % copies) * cells;
+                for (int c = 0; c < 8; ++c)
+                {
+                    sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device> node_ref(grid[nodes[c]]);
+                    node_ref.fetch_add(weights[c] * mass);
+                }
+            });
+        }).wait();
+
+        const float invVolume = 1.0f / (cell * cell * cell);
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(cells), [=](sycl::id<1> idx_d){
+                size_t n = idx_d.get(0);
+                float m = 0.0f;
+                for (size_t c = 0; c < copies; ++c)
+                    m += dep[c * cells + n];
+                field[n] = sycl::vec<float, 2>(m * invVolume, 0.0f);
+            });
+        }).wait();
+    }
+
+    // in-place radix-2 transform of every line of every axis. a work-group of
+    // res / 2 items loads a line bit-reversed into local memory, runs the
+    // log2(res) butterfly stages there and writes it back. the inverse is
+    // scaled by 1 / res^3.
+    void fft(bool inverse)
+    {
+        const size_t res = m_res;
+        const size_t half = res / 2;
+        const size_t lines = res * res;
+        unsigned int bits = 0;
+        while ((1u << bits) < res) ++bits;
+        const float sign = inverse ? 1.0f : -1.0f;
+        const float scale = inverse ? 1.0f / (float)res : 1.0f; // once per axis
+        sycl::vec<float, 2> *field = m_field;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const size_t stride = axis == 0 ? 1 : axis == 1 ? res : res * res;
+            q.submit([&](sycl::handler &h){
+                sycl::local_accessor<sycl::vec<float, 2>, 1> line(sycl::range<1>(res), h);
+                h.parallel_for(sycl::nd_range<1>(lines * half, half), [=](sycl::nd_item<1> it){
+                    size_t l = it.get_group(0);
+                    size_t t = it.get_local_id(0);
+                    // first element of line l, the other two axes enumerate the lines
+                    size_t base = axis == 0 ? l * res : axis == 1 ? (l / res) * res * res + l % res : l;
+                    for (size_t e = t; e < res; e += half)
+                    {
+                        unsigned int r = 0;
+                        for (unsigned int b = 0; b < bits; ++b)
+                            r |= ((e >> b) & 1u) << (bits - 1 - b);
+                        line[r] = field[base + e * stride];
+                    }
+                    for (size_t m = 1; m < res; m <<= 1)
+                    {
+                        sycl::group_barrier(it.get_group());
+                        size_t k = t % m;
+                        size_t i0 = (t / m) * 2 * m + k;
+                        size_t i1 = i0 + m;
+                        float angle = sign * (float)M_PI * (float)k / (float)m;
+                        sycl::vec<float, 2> w(sycl::cos(angle), sycl::sin(angle));
+                        sycl::vec<float, 2> a = line[i0];
+                        sycl::vec<float, 2> b = line[i1];
+                        sycl::vec<float, 2> wb(w.x() * b.x() - w.y() * b.y(), w.x() * b.y() + w.y() * b.x());
+                        line[i0] = a + wb;
+                        line[i1] = a - wb;
+                    }
+                    sycl::group_barrier(it.get_group());
+                    for (size_t e = t; e < res; e += half)
+                        field[base + e * stride] = line[e] * scale;
+                });
+            }).wait();
+        }
+    }
+
+    // laplacian phi = 4 pi G rho, with the eigenvalues of the 7 point
+    // laplacian: -(2 sin(pi m / res) / cell)^2 for mode m along an axis.
+    // gradient() is a separate central difference, so the pair is not an
+    // exact inverse (that eigenvalue would be -(sin(2 pi m / res) / cell)^2,
+    // zero at the nyquist mode too). the 7 point one only has m = 0 as a
+    // null mode, which is dropped.
+    void solve()
+    {
+        const size_t res = m_res;
+        const size_t cells = res * res * res;
+        const float cell = m_size / (float)m_res;
+        const float fourPiG = 4.0f * (float)M_PI * m_G;
+        sycl::vec<float, 2> *field = m_field;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(cells), [=](sycl::id<1> idx_d){
+                size_t n = idx_d.get(0);
+                size_t i = n % res, j = (n / res) % res, k = n / (res * res);
+                float sx = sycl::sin((float)M_PI * (float)i / (float)res);
+                float sy = sycl::sin((float)M_PI * (float)j / (float)res);
+                float sz = sycl::sin((float)M_PI * (float)k / (float)res);
+                float k2 = 4.0f / (cell * cell) * (sx * sx + sy * sy + sz * sz);
+                field[n] = k2 > 0.0f ? field[n] * (-fourPiG / k2) : sycl::vec<float, 2>(0.0f);
+            });
+        }).wait();
+    }
+
+    void gradient()
+    {
+        const size_t res = m_res;
+        const size_t cells = res * res * res;
+        const size_t mask = res - 1;
+        const float inv2Cell = (float)m_res / (2.0f * m_size);
+        const sycl::vec<float, 2> *field = m_field;
+        sycl::vec<float, 4> *force = m_force;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(cells), [=](sycl::id<1> idx_d){
+                size_t n = idx_d.get(0);
+                size_t i = n % res, j = (n / res) % res, k = n / (res * res);
+                auto phi = [&](size_t x, size_t y, size_t z){ return field[((z & mask) * res + (y & mask)) * res + (x & mask)].x(); };
+                force[n] = sycl::vec<float, 4>(-(phi(i + 1, j, k) - phi(i + mask, j, k)) * inv2Cell,
+                                               -(phi(i, j + 1, k) - phi(i, j + mask, k)) * inv2Cell,
+                                               -(phi(i, j, k + 1) - phi(i, j, k + mask)) * inv2Cell, 0.0f);
+            });
+        }).wait();
+    }
+
+    void gather(double dt, Particle_system &p)
+    {
+        const size_t endId = p.m_highWater;
+        const size_t res = m_res;
+        const sycl::vec<float, 4> origin = m_origin;
+        const float cell = m_size / (float)m_res;
+        const float localDT = (float)dt;
+        const sycl::vec<float, 4> *force = m_force;
+        Particle *buf_acc = p.m_particle;
+        const unsigned char *alive_acc = p.m_alive;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if (alive_acc[idx] == 0) return;
+                size_t nodes[8];
+                float weights[8];
+                if (!cic(buf_acc[idx].pos, origin, cell, res, nodes, weights)) return;
+                sycl::vec<float, 4> a(0.0f);
+                for (int c = 0; c < 8; ++c)
+                    a += force[nodes[c]] * weights[c];
+                buf_acc[idx].vel += localDT * a;
+            });
+        }).wait();
+    }
+};
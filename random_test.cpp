@@ -1,110 +1,192 @@
 #include <sycl/sycl.hpp>
-
-#include <random>
-
-
-class RandomFiller {
-
-public:
-
-  RandomFiller(int *ptr) : ptr_{ptr} {
-
-    std::random_device hwRand;
-
-    std::uniform_int_distribution<> r{1, 100};
-
-    randomNum_ = r(hwRand);
-
-  }
-
-  void operator()(sycl::item<1> item) const {
-
-    ptr_[item.get_id()] = get_random();
-
-  }
-
-  int get_random() const { return randomNum_; }
-
-
-private:
-
-  int *ptr_;
-
-  int randomNum_;
-
-};
-
-// extern SYCL_EXTERNAL unsigned int time(unsigned int *tloc);
-
-
-sycl::vec<unsigned int, 4> my_srand (sycl::vec<unsigned int, 4> newseed) {
-    sycl::vec<unsigned int, 4> seed(1);
-    seed = newseed.convert<unsigned int>() & sycl::vec<unsigned int, 4>(0x7fffffffU);
-    return seed;
-}
-
-
-sycl::vec<int, 4> my_rand (sycl::vec<unsigned int, 4> seed) {
-    seed = (seed * sycl::vec<unsigned int, 4>(1103515245U) + sycl::vec<unsigned int, 4>(12345U)) & sycl::vec<unsigned int, 4>(0x7fffffffU);
-    return seed.convert<int>();
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include "my_random.hpp"
+#include "rng_stream.hpp"
+
+// throughput of the old time-seeded LCG against the counter-based philox
+// generator, both filling the same buffer of float4 on the same queue.
+// the LCG lives in my_random.cpp (SYCL_EXTERNAL) while philox is inlined,
+// which is part of what this measures.
+// then every RngStream distribution is timed and checked: moments against
+// the exact ones and a chi-square over 64 bins. exits 1 if a check fails.
+
+const int BINS = 64;
+// 63 degrees of freedom, p = 0.001
+const double CHI2_LIMIT = 103.4;
+
+bool check(const char *what, double got, double want, double tol)
+{
+    bool ok = std::fabs(got - want) <= tol;
+    std::cout << "  " << what << ": " << got << " (want " << want << ") " << (ok ? "ok" : "FAIL") << std::endl;
+    return ok;
 }
 
-sycl::vec<float, 4> my_randf (sycl::vec<unsigned int, 4> seed) {
-    return my_rand(seed).convert<float>() / sycl::vec<float, 4>((float)0x7fffffffU);
-}
-
-sycl::vec<int, 4> random_range(int min, int max, unsigned int time) {
-    if (min > max) {
-        std::swap(min, max);
+// values are expected in [lo, hi)
+bool chi_square(const char *what, const std::vector<double> &values, double lo, double hi)
+{
+    std::vector<double> bins(BINS, 0.0);
+    for(double v : values)
+    {
+        int b = (int)((v - lo) / (hi - lo) * BINS);
+        bins[std::min(std::max(b, 0), BINS - 1)] += 1.0;
     }
-    return my_rand(my_srand(sycl::vec<unsigned int, 4>(time, time * 1000, time * 2000, time * 3000))) % (max - min + 1) + min;
+    double expected = (double)values.size() / BINS;
+    double chi2 = 0.0;
+    for(double b : bins)
+        chi2 += (b - expected) * (b - expected) / expected;
+    bool ok = chi2 < CHI2_LIMIT;
+    std::cout << "  chi-square " << what << ": " << chi2 << " (limit " << CHI2_LIMIT << ") " << (ok ? "ok" : "FAIL") << std::endl;
+    return ok;
 }
 
-sycl::vec<float, 4> random_rangef(float min, float max, unsigned int time) {
-    if (min > max) {
-        std::swap(min, max);
+// mean, variance, skewness and kurtosis
+void moments(const std::vector<double> &v, double &mean, double &var, double &skew, double &kurt)
+{
+    mean = 0.0;
+    for(double x : v) mean += x;
+    mean /= v.size();
+    double m2 = 0.0, m3 = 0.0, m4 = 0.0;
+    for(double x : v)
+    {
+        double d = x - mean;
+        m2 += d * d;
+        m3 += d * d * d;
+        m4 += d * d * d * d;
     }
-    
-    return my_randf(my_srand(sycl::vec<unsigned int, 4>(time, time * 1000, time * 2000, time * 3000))) * (max - min) + min;
+    m2 /= v.size();
+    m3 /= v.size();
+    m4 /= v.size();
+    var = m2;
+    skew = m3 / std::pow(m2, 1.5);
+    kurt = m4 / (m2 * m2);
 }
 
+template<typename Fill>
+double bench(size_t size, int reps, Fill fill)
+{
+    fill(); // warm up, jit and first touch of the buffer
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int r = 0; r < reps; ++r)
+        fill();
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    return (double)size * 4 * reps / seconds;
+}
 
 int main(int argc, char **argv) {
-    
-    sycl::queue q(sycl::gpu_selector_v);
-    size_t size = 10;
-    sycl::vec<float, 4> *p = sycl::malloc_shared<sycl::vec<float, 4>>(size, q);
-    for(size_t i = 0; i < size; ++i) {
-        p[i] = 0;
-    }
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_int_distribution<int> distribution(0,10);
-    // *p = 0;
-    distribution(rng);
+    size_t size = 1 << 22;
+    int reps = 10;
+    if(argc > 1)
+        size = std::stoul(std::string(argv[1]));
+
+    sycl::queue q(sycl::cpu_selector_v);
+    std::cout << "Device: " << q.get_device().get_info<sycl::info::device::name>() << std::endl;
+    sycl::vec<float, 4> *p = sycl::malloc_device<sycl::vec<float, 4>>(size, q);
+    sycl::vec<float, 4> min(0.0f);
+    sycl::vec<float, 4> max(100.0f);
     unsigned int my_time = time(0);
-    q.submit([&](sycl::handler &h) {
-        
-        h.parallel_for<class random_kernel>(sycl::range<1>(size), [=](sycl::id<1> id) {
-            // unsigned int seed = my_srand(my_time + id.get(0) * 2);
-            // std::cout << "Random number from kernel: " << p[id.get(0)] << std::endl;
-            p[id.get(0)] = random_rangef(0, 100, my_time + id.get(0) * 1000);
-        });
-    }).wait();
-    for(size_t i = 0; i < size; ++i) {
-        std::cout << "Random number from kernel: " << p[i][0] << ", " << p[i][1] << ", " << p[i][2] << ", " << p[i][3] << std::endl;
+    unsigned long long seed = my_time;
+
+    double lcg = bench(size, reps, [&](){
+        q.submit([&](sycl::handler &h) {
+            h.parallel_for<class lcg_kernel>(sycl::range<1>(size), [=](sycl::id<1> id) {
+                p[id.get(0)] = random_rangef(min, max, my_time + id.get(0) * 1000);
+            });
+        }).wait();
+    });
+
+    unsigned int frame = 0;
+    double philox = bench(size, reps, [&](){
+        unsigned int f = frame++;
+        q.submit([&](sycl::handler &h) {
+            h.parallel_for<class philox_kernel>(sycl::range<1>(size), [=](sycl::id<1> id) {
+                p[id.get(0)] = philox_rangef(min, max, seed, id.get(0), f, STREAM_POS);
+            });
+        }).wait();
+    });
+
+    sycl::vec<float, 4> sample[4];
+    q.copy<sycl::vec<float, 4>>(p, sample, 4).wait();
+    for(size_t i = 0; i < 4; ++i) {
+        std::cout << "Random number from kernel: " << sample[i][0] << ", " << sample[i][1] << ", " << sample[i][2] << ", " << sample[i][3] << std::endl;
     }
+    std::cout << "lcg    : " << lcg / 1e6 << " M samples/s" << std::endl;
+    std::cout << "philox : " << philox / 1e6 << " M samples/s" << std::endl;
+
+    RngStream stream(q, seed);
+    const char *names[] = { "uniform", "normal", "sphere", "disk" };
+    std::vector<sycl::vec<float, 4>> host(size);
+    bool ok = true;
+    for(unsigned int d = RNG_UNIFORM; d <= RNG_DISK; ++d)
+    {
+        RngDistribution dist = (RngDistribution)d;
+        double rate = bench(size, reps, [&](){ stream.fill(p, size, dist).wait(); });
+        // sphere and disk give one point per float4, the others four values
+        if(dist == RNG_SPHERE || dist == RNG_DISK) rate /= 4;
+        std::cout << names[d] << " : " << rate / 1e6 << " M samples/s" << std::endl;
+
+        q.copy<sycl::vec<float, 4>>(p, host.data(), size).wait();
+        std::vector<double> values;
+        double mean, var, skew, kurt;
+        if(dist == RNG_UNIFORM || dist == RNG_NORMAL)
+        {
+            for(const auto &v : host)
+                for(int c = 0; c < 4; ++c) values.push_back(v[c]);
+            moments(values, mean, var, skew, kurt);
+            if(dist == RNG_UNIFORM)
+            {
+                ok &= check("mean", mean, 0.5, 0.005);
+                ok &= check("variance", var, 1.0 / 12.0, 0.005);
+                ok &= chi_square("of the values", values, 0.0, 1.0);
+            }
+            else
+            {
+                ok &= check("mean", mean, 0.0, 0.01);
+                ok &= check("variance", var, 1.0, 0.01);
+                ok &= check("skewness", skew, 0.0, 0.02);
+                ok &= check("kurtosis", kurt, 3.0, 0.05);
+                // the normal cdf of every value is uniform
+                for(double &x : values) x = 0.5 * std::erfc(-x / std::sqrt(2.0));
+                ok &= chi_square("of the cdf", values, 0.0, 1.0);
+            }
+        }
+        else if(dist == RNG_SPHERE)
+        {
+            double maxErr = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+            for(const auto &v : host)
+            {
+                double r = std::sqrt((double)v[0] * v[0] + (double)v[1] * v[1] + (double)v[2] * v[2]);
+                maxErr = std::max(maxErr, std::fabs(r - 1.0));
+                mx += v[0]; my += v[1]; mz += v[2];
+                values.push_back(v[2]); // archimedes: z is uniform in [-1, 1]
+            }
+            ok &= check("max | |v| - 1 |", maxErr, 0.0, 1e-5);
+            ok &= check("mean x", mx / size, 0.0, 0.01);
+            ok &= check("mean y", my / size, 0.0, 0.01);
+            ok &= check("mean z", mz / size, 0.0, 0.01);
+            ok &= chi_square("of z", values, -1.0, 1.0);
+        }
+        else
+        {
+            double maxR = 0.0;
+            std::vector<double> angles;
+            for(const auto &v : host)
+            {
+                double r2 = (double)v[0] * v[0] + (double)v[1] * v[1];
+                maxR = std::max(maxR, std::sqrt(r2));
+                values.push_back(r2); // uniform in [0, 1] for an even disk
+                angles.push_back(std::atan2((double)v[1], (double)v[0]));
+            }
+            ok &= check("max radius", maxR, 1.0, 1e-5);
+            ok &= chi_square("of r^2", values, 0.0, 1.0);
+            ok &= chi_square("of the angle", angles, -M_PI, M_PI);
+        }
+    }
+    std::cout << (ok ? "all checks passed" : "some checks FAILED") << std::endl;
     sycl::free(p, q);
-
-    sycl::device device = sycl::device(sycl::gpu_selector_v);
-    std::cout << "Device: " << device.get_info<sycl::info::device::name>() << std::endl;
-    std::cout << "Device vendor: " << device.get_info<sycl::info::device::vendor>() << std::endl;
-    std::cout << "Device version: " << device.get_info<sycl::info::device::version>() << std::endl;
-    std::cout << "Device driver version: " << device.get_info<sycl::info::device::driver_version>() << std::endl;
-    std::cout << "Device max compute units: " << device.get_info<sycl::info::device::max_compute_units>() << std::endl;
-    std::cout << "Device max work group size: " << device.get_info<sycl::info::device::max_work_group_size>() << std::endl;
-    sycl::vec<unsigned int, 4> my_time2(time(0), time(0) + 1000, time(0) + 2000, time(0) + 3000);
-    sycl::vec<int, 4> random_number = my_rand(my_time2) % 100; // Generate a random number between 0 and 99
-    std::cout << "Random number: " << random_number[0] << ", " << random_number[1] << ", " << random_number[2] << ", " << random_number[3] << std::endl;
-    return 0;
-}
\ No newline at end of file
+    return ok ? 0 : 1;
+}
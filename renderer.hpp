@@ -61,6 +61,8 @@ private:
     float radius = 100.0f;
 
 public:
+    float m_renderScale = 1.0f; // particles are drawn at this fraction of the screen size, then stretched
+
     Renderer(size_t w, size_t h): proj(), width(w), hieght(h), camera(sycl::vec<float, 3>{-100.0f, -100.0f, 100.0f}, sycl::vec<float, 3>{0.0f, 0.0f, 0.0f}, sycl::vec<float, 3>{0.0f, 1.0f, 0.0f}) {
         float fov_rad = 90.0f * (M_PI / 180.0f);
         proj.setProjectionMatrix(fov_rad, static_cast<float>(width) / hieght, 0.01f, 10000.0f);
@@ -69,11 +71,19 @@ public:
     }
     ~Renderer() = default;
 
+    // the camera of the last draw(), for the simulation lod
+    Mat4x4 view_proj() const { return proj * camera.GetViewMatrix(); }
+    sycl::vec<float, 3> eye() const { return camera.GetEye(); }
+
 
 
 void draw(float dt, Image &im, Texture2D &tex, sycl::vec<unsigned char, 4> *color, size_t width, size_t hieght, Particle_system &p, sycl::queue &q)
 { 
     (void)p;
+    const size_t fullWidth = width;
+    const size_t fullHieght = hieght;
+    width = std::max<size_t>(1, (size_t)(fullWidth * m_renderScale));
+    hieght = std::max<size_t>(1, (size_t)(fullHieght * m_renderScale));
     q.submit([&](sycl::handler &h){
         auto acc = color;
         h.parallel_for(sycl::range<1>(width*hieght), [=](sycl::id<1> idx_d){
@@ -102,62 +112,76 @@ void draw(float dt, Image &im, Texture2D &tex, sycl::vec<unsigned char, 4> *colo
     camera.SetCameraView(sycl::vec<float, 3>{camX, 0.0f, camZ}, sycl::vec<float, 3>{0.0f, 0.0f, 0.0f}, sycl::vec<float, 3>{0.0f, 1.0f, 0.0f});
     Mat4x4 view = camera.GetViewMatrix();
     Mat4x4 proj = this->proj;
-    q.submit([&](sycl::handler &h){
-        auto acc = p.m_particle;
-        auto acc_col = color;
-        h.parallel_for(sycl::range<1>(p.size), [=](sycl::id<1> idx_d){
-            size_t idx = idx_d.get(0);
-            if(acc[idx].alive == false)
-            {
-                return;
-            }
-            sycl::vec<float, 4> pos_world = acc[idx].pos;
-            sycl::vec<float, 4> pos_clip = proj * view * pos_world;
-
-            // Perspective divide (already done in matrix multiplication if w != 1)
-            // If w is 0, the point is at infinity, skip it
-            if (pos_clip.w() == 0.0f) return;
-            // pos_clip.x() *= width / 5;
-            // pos_clip.y() *= hieght / 5; // Corrected to use pos_clip.w() for height
+    if(p.m_highWater > 0)
+    {
+        q.submit([&](sycl::handler &h){
+            auto acc = p.m_particle;
+            auto alive = p.m_alive;
+            auto acc_col = color;
+            h.parallel_for(sycl::range<1>(p.m_highWater), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if(alive[idx] == 0)
+                {
+                    return;
+                }
+                sycl::vec<float, 4> pos_world = acc[idx].pos;
+                sycl::vec<float, 4> pos_clip = proj * view * pos_world;
+
+                // Perspective divide (already done in matrix multiplication if w != 1)
+                // If w is 0, the point is at infinity, skip it
+                if (pos_clip.w() == 0.0f) return;
+                // pos_clip.x() *= width / 5;
+                // pos_clip.y() *= hieght / 5; // Corrected to use pos_clip.w() for height
             
-            // Assuming perspective divide happened in operator*:
-            sycl::vec<float, 3> pos_ndc = {pos_clip.x(), pos_clip.y(), pos_clip.z()};
-
-            // Check if the point is within the clip volume (NDC range)
-            if (pos_ndc.x() >= -1.0f && pos_ndc.x() <= 1.0f &&
-                pos_ndc.y() >= -1.0f && pos_ndc.y() <= 1.0f &&
-                pos_ndc.z() >= -1.0f && pos_ndc.z() <= 1.0f) // Check Z as well
-            {
-                // Map NDC to screen coordinates
-                float screenX = (pos_ndc.x() + 1.0f) * 0.5f * width;
-                float screenY = (1.0f - pos_ndc.y()) * 0.5f * hieght; // Y is often inverted
-                // float screenX = ((pos_world.x() + width) / 2.0f); // X is often inverted
-                // float screenY = ((pos_world.y() + hieght) / 2.0f); // Y is often inverted
-                // Check if screen coordinates are within image bounds
-                if (screenX >= 0 && screenX < width && screenY >= 0 && screenY < hieght)
+                // Assuming perspective divide happened in operator*:
+                sycl::vec<float, 3> pos_ndc = {pos_clip.x(), pos_clip.y(), pos_clip.z()};
+
+                // Check if the point is within the clip volume (NDC range)
+                if (pos_ndc.x() >= -1.0f && pos_ndc.x() <= 1.0f &&
+                    pos_ndc.y() >= -1.0f && pos_ndc.y() <= 1.0f &&
+                    pos_ndc.z() >= -1.0f && pos_ndc.z() <= 1.0f) // Check Z as well
                 {
-                    long pixelIndex = static_cast<long>(screenY) * width + static_cast<long>(screenX);
-                    // if(acc_col[pixelIndex].x() == 0 && acc_col[pixelIndex].y() == 0 && acc_col[pixelIndex].z() == 0)
-                    // {
-                    //     acc_col[pixelIndex] = acc[idx].col.convert<char>(); // Draw particle color
-                    // }
-                    // else
-                    // {
-                    //     acc_col[pixelIndex] |=  acc[idx].col.convert<char>(); // Blend with existing color
-                    // }
-                    // sycl::atomic_fence(sycl::memory_order::acq_rel, sycl::memory_scope::device);
-                    acc_col[pixelIndex] = sycl::mix(acc_col[pixelIndex].convert<float>(), acc[idx].col, sycl::float4(0.5f)).convert<unsigned char>(); // Draw particle color
-                    // sycl::atomic_fence(sycl::memory_order::release, sycl::memory_scope::device);
+                    // Map NDC to screen coordinates
+                    float screenX = (pos_ndc.x() + 1.0f) * 0.5f * width;
+                    float screenY = (1.0f - pos_ndc.y()) * 0.5f * hieght; // Y is often inverted
+                    // float screenX = ((pos_world.x() + width) / 2.0f); // X is often inverted
+                    // float screenY = ((pos_world.y() + hieght) / 2.0f); // Y is often inverted
+                    // Check if screen coordinates are within image bounds
+                    if (screenX >= 0 && screenX < width && screenY >= 0 && screenY < hieght)
+                    {
+                        long pixelIndex = static_cast<long>(screenY) * width + static_cast<long>(screenX);
+                        // if(acc_col[pixelIndex].x() == 0 && acc_col[pixelIndex].y() == 0 && acc_col[pixelIndex].z() == 0)
+                        // {
+                        //     acc_col[pixelIndex] = acc[idx].col.convert<char>(); // Draw particle color
+                        // }
+                        // else
+                        // {
+                        //     acc_col[pixelIndex] |=  acc[idx].col.convert<char>(); // Blend with existing color
+                        // }
+                        // sycl::atomic_fence(sycl::memory_order::acq_rel, sycl::memory_scope::device);
+                        acc_col[pixelIndex] = sycl::mix(acc_col[pixelIndex].convert<float>(), acc[idx].col, sycl::float4(0.5f)).convert<unsigned char>(); // Draw particle color
+                        // sycl::atomic_fence(sycl::memory_order::release, sycl::memory_scope::device);
+                    }
                 }
-            }
-        });
-    }).wait();
+            });
+        }).wait();
+    }
     q.wait();
     
     q.copy<sycl::vec<unsigned char, 4>>(color, (sycl::vec<unsigned char, 4>*)im.data, width*hieght);
     q.wait();
-    UpdateTexture(tex, im.data);
-    DrawTexture(tex, 0, 0, WHITE);
+    if(width == fullWidth && hieght == fullHieght)
+    {
+        UpdateTexture(tex, im.data);
+        DrawTexture(tex, 0, 0, WHITE);
+    }
+    else
+    {
+        // the smaller frame sits packed at the start of the canvas
+        Rectangle src = { 0.0f, 0.0f, (float)width, (float)hieght };
+        UpdateTextureRec(tex, src, im.data);
+        DrawTexturePro(tex, src, Rectangle{ 0.0f, 0.0f, (float)fullWidth, (float)fullHieght }, Vector2{ 0.0f, 0.0f }, 0.0f, WHITE);
+    }
 }
 
 };
\ No newline at end of file
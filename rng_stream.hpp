@@ -0,0 +1,93 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <cmath>
+#include "my_random.hpp"
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// distributions from four uniforms in [0, 1), usable inside any kernel
+
+// four independent standard normals, box-muller on both pairs
+inline sycl::vec<float, 4> normal_from_uniform(sycl::vec<float, 4> u)
+{
+    // 1 - u is in (0, 1], the log never sees 0
+    float r0 = sycl::sqrt(-2.0f * sycl::log(1.0f - u.x()));
+    float r1 = sycl::sqrt(-2.0f * sycl::log(1.0f - u.z()));
+    float a0 = u.y() * (float)(M_PI * 2.0);
+    float a1 = u.w() * (float)(M_PI * 2.0);
+    return sycl::vec<float, 4>(r0 * sycl::cos(a0), r0 * sycl::sin(a0), r1 * sycl::cos(a1), r1 * sycl::sin(a1));
+}
+
+// uniform point on the unit sphere in xyz, w = 0
+inline sycl::vec<float, 4> sphere_from_uniform(sycl::vec<float, 4> u)
+{
+    float z = 2.0f * u.x() - 1.0f;
+    float r = sycl::sqrt(sycl::max(0.0f, 1.0f - z * z));
+    float a = u.y() * (float)(M_PI * 2.0);
+    return sycl::vec<float, 4>(r * sycl::cos(a), r * sycl::sin(a), z, 0.0f);
+}
+
+// uniform point inside the unit disk in xy, zw = 0
+inline sycl::vec<float, 4> disk_from_uniform(sycl::vec<float, 4> u)
+{
+    float r = sycl::sqrt(u.x());
+    float a = u.y() * (float)(M_PI * 2.0);
+    return sycl::vec<float, 4>(r * sycl::cos(a), r * sycl::sin(a), 0.0f, 0.0f);
+}
+
+enum RngDistribution : unsigned int
+{
+    RNG_UNIFORM,
+    RNG_NORMAL,
+    RNG_SPHERE,
+    RNG_DISK,
+};
+
+// a philox stream that fills usm buffers in bulk, one float4 per work-item.
+// every fill continues where the last one stopped, so a batch never repeats
+// and a run is reproducible from (seed, channel) alone. two streams with the
+// same seed stay independent as long as their channels differ.
+class RngStream
+{
+public:
+    unsigned long long m_seed{ 0 };
+    unsigned int m_channel{ 0 };
+    unsigned long long m_offset{ 0 }; // samples handed out so far
+    sycl::queue q;
+public:
+    RngStream(unsigned long long seed = 0, unsigned int channel = 0): m_seed(seed), m_channel(channel), q(sycl::gpu_selector_v) {}
+    RngStream(sycl::queue queue, unsigned long long seed, unsigned int channel = 0): m_seed(seed), m_channel(channel), q(queue) {}
+
+    sycl::event fill(sycl::vec<float, 4> *out, size_t count, RngDistribution dist)
+    {
+        switch (dist)
+        {
+        case RNG_NORMAL: return fill_with(out, count, [](sycl::vec<float, 4> u){ return normal_from_uniform(u); });
+        case RNG_SPHERE: return fill_with(out, count, [](sycl::vec<float, 4> u){ return sphere_from_uniform(u); });
+        case RNG_DISK:   return fill_with(out, count, [](sycl::vec<float, 4> u){ return disk_from_uniform(u); });
+        default:         return fill_with(out, count, [](sycl::vec<float, 4> u){ return u; });
+        }
+    }
+
+    sycl::event fill_uniform(sycl::vec<float, 4> *out, size_t count) { return fill(out, count, RNG_UNIFORM); }
+    sycl::event fill_normal(sycl::vec<float, 4> *out, size_t count) { return fill(out, count, RNG_NORMAL); }
+    sycl::event fill_sphere(sycl::vec<float, 4> *out, size_t count) { return fill(out, count, RNG_SPHERE); }
+    sycl::event fill_disk(sycl::vec<float, 4> *out, size_t count) { return fill(out, count, RNG_DISK); }
+
+private:
+    template<class Transform>
+    sycl::event fill_with(sycl::vec<float, 4> *out, size_t count, Transform transform)
+    {
+        const unsigned long long seed = m_seed;
+        const unsigned long long offset = m_offset;
+        const unsigned int channel = m_channel;
+        m_offset += count;
+        return q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(count), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                out[idx] = transform(philox_randf(seed, offset + idx, channel, STREAM_BULK));
+            });
+        });
+    }
+};
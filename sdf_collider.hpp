@@ -0,0 +1,358 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <array>
+#include "particle.hpp"
+#include "colliders.hpp"
+
+// static scene geometry baked into a signed distance grid, so a particle pays
+// one trilinear lookup whatever the scene looks like. two ways to bake:
+//  - from a ColliderSet, the union (min) of the analytic distances per node
+//  - from triangles with a jump flood on the device: every triangle seeds the
+//    nodes next to it, then log2(res) + 1 passes let each node adopt the
+//    nearest triangle of its 26 neighbours at step 2^k. distances are exact
+//    to the triangle found. the sign comes from the angle weighted pseudo
+//    normal (Baerentzen, Aanaes) of the face, edge or corner the node is
+//    closest to: at a spike or a thin fin the face normal of whichever
+//    triangle won the tie can point away from the node. the mesh has to be
+//    closed and wound consistently (raylib's counter-clockwise)
+// nodes sit on the corners of the cells, m_origin is node (0, 0, 0).
+
+const unsigned int SDF_NO_TRIANGLE = 0xffffffffu;
+
+// device side, copy it into a kernel
+class SdfView
+{
+public:
+    const float *m_dist{ nullptr };
+    sycl::vec<float, 4> m_origin{ 0.0f };
+    float m_cellSize{ 1.0f };
+    unsigned int m_nx{ 0 }, m_ny{ 0 }, m_nz{ 0 };
+
+    bool valid() const { return m_dist != nullptr; }
+
+    // trilinear distance and its normalised gradient, far away (1e30) outside the grid
+    float distance(const sycl::vec<float, 4> &pos, sycl::vec<float, 4> &normal) const
+    {
+        float fx = (pos.x() - m_origin.x()) / m_cellSize;
+        float fy = (pos.y() - m_origin.y()) / m_cellSize;
+        float fz = (pos.z() - m_origin.z()) / m_cellSize;
+        if (!(fx >= 0.0f && fy >= 0.0f && fz >= 0.0f && fx < (float)(m_nx - 1) && fy < (float)(m_ny - 1) && fz < (float)(m_nz - 1)))
+            return 1e30f;
+        unsigned int x = (unsigned int)fx, y = (unsigned int)fy, z = (unsigned int)fz;
+        float tx = fx - x, ty = fy - y, tz = fz - z;
+        auto at = [&](unsigned int i, unsigned int j, unsigned int k){ return m_dist[((size_t)k * m_ny + j) * m_nx + i]; };
+        float d000 = at(x, y, z), d100 = at(x + 1, y, z), d010 = at(x, y + 1, z), d110 = at(x + 1, y + 1, z);
+        float d001 = at(x, y, z + 1), d101 = at(x + 1, y, z + 1), d011 = at(x, y + 1, z + 1), d111 = at(x + 1, y + 1, z + 1);
+        float d00 = d000 + (d100 - d000) * tx, d10 = d010 + (d110 - d010) * tx;
+        float d01 = d001 + (d101 - d001) * tx, d11 = d011 + (d111 - d011) * tx;
+        float d0 = d00 + (d10 - d00) * ty, d1 = d01 + (d11 - d01) * ty;
+        // derivative of the same interpolation along each axis
+        float gx = ((d100 - d000) * (1.0f - ty) + (d110 - d010) * ty) * (1.0f - tz)
+                 + ((d101 - d001) * (1.0f - ty) + (d111 - d011) * ty) * tz;
+        float gy = (d10 - d00) * (1.0f - tz) + (d11 - d01) * tz;
+        float gz = d1 - d0;
+        sycl::vec<float, 4> g(gx, gy, gz, 0.0f);
+        float len = sycl::length(g);
+        normal = len > 1e-12f ? g / len : sycl::vec<float, 4>(0.0f, -1.0f, 0.0f, 0.0f);
+        return d0 + (d1 - d0) * tz;
+    }
+};
+
+// which part of the triangle closest_on_triangle() landed on, also the
+// index of its pseudo normal among the 7 of the triangle
+const unsigned int TRI_FACE = 0;
+const unsigned int TRI_A = 1, TRI_B = 2, TRI_C = 3;
+const unsigned int TRI_AB = 4, TRI_BC = 5, TRI_CA = 6;
+const unsigned int TRI_FEATURES = 7;
+
+// closest point to p on the triangle abc (Ericson, real-time collision detection 5.1.5)
+inline sycl::vec<float, 4> closest_on_triangle(const sycl::vec<float, 4> &p, const sycl::vec<float, 4> &a, const sycl::vec<float, 4> &b, const sycl::vec<float, 4> &c, unsigned int &feature)
+{
+    sycl::vec<float, 4> ab = b - a, ac = c - a, ap = p - a;
+    ab.w() = ac.w() = ap.w() = 0.0f;
+    float d1 = sycl::dot(ab, ap), d2 = sycl::dot(ac, ap);
+    feature = TRI_A;
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+    sycl::vec<float, 4> bp = p - b;
+    bp.w() = 0.0f;
+    float d3 = sycl::dot(ab, bp), d4 = sycl::dot(ac, bp);
+    feature = TRI_B;
+    if (d3 >= 0.0f && d4 <= d3) return b;
+    float vc = d1 * d4 - d3 * d2;
+    feature = TRI_AB;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+    sycl::vec<float, 4> cp = p - c;
+    cp.w() = 0.0f;
+    float d5 = sycl::dot(ab, cp), d6 = sycl::dot(ac, cp);
+    feature = TRI_C;
+    if (d6 >= 0.0f && d5 <= d6) return c;
+    float vb = d5 * d2 - d1 * d6;
+    feature = TRI_CA;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+    float va = d3 * d6 - d5 * d4;
+    feature = TRI_BC;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    feature = TRI_FACE;
+    float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+inline sycl::vec<float, 4> closest_on_triangle(const sycl::vec<float, 4> &p, const sycl::vec<float, 4> &a, const sycl::vec<float, 4> &b, const sycl::vec<float, 4> &c)
+{
+    unsigned int feature;
+    return closest_on_triangle(p, a, b, c, feature);
+}
+
+class SdfCollider
+{
+public:
+    sycl::vec<float, 4> m_origin{ -800.0f, -200.0f, -800.0f, 0.0f };
+    float m_cellSize{ 12.5f };
+    sycl::queue q;
+private:
+    unsigned int m_nx, m_ny, m_nz;
+    float *m_dist{ nullptr };
+public:
+    SdfCollider(unsigned int nx = 129, unsigned int ny = 97, unsigned int nz = 129): q(sycl::gpu_selector_v), m_nx(nx), m_ny(ny), m_nz(nz)
+    {
+        m_dist = sycl::malloc_device<float>(nodes(), q);
+    }
+    SdfCollider(const SdfCollider &) = delete;
+    SdfCollider &operator=(const SdfCollider &) = delete;
+    ~SdfCollider()
+    {
+        sycl::free(m_dist, q);
+    }
+
+    size_t nodes() const { return (size_t)m_nx * m_ny * m_nz; }
+
+    SdfView view() const
+    {
+        return SdfView{ m_dist, m_origin, m_cellSize, m_nx, m_ny, m_nz };
+    }
+
+    // union of the analytic colliders, exact outside, a bound inside where they overlap
+    void bake(const ColliderSet &set)
+    {
+        const size_t count = set.m_colliders.size();
+        const size_t n = nodes();
+        if (count == 0)
+        {
+            std::vector<float> far(n, 1e30f);
+            q.memcpy(m_dist, far.data(), sizeof(float) * n).wait();
+            return;
+        }
+        Collider *colliders = sycl::malloc_device<Collider>(count, q);
+        q.memcpy(colliders, set.m_colliders.data(), sizeof(Collider) * count).wait();
+        float *dist = m_dist;
+        const sycl::vec<float, 4> origin = m_origin;
+        const float cell = m_cellSize;
+        const unsigned int nx = m_nx, ny = m_ny;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                sycl::vec<float, 4> pos = origin + cell * sycl::vec<float, 4>((float)(idx % nx), (float)((idx / nx) % ny), (float)(idx / ((size_t)nx * ny)), 0.0f);
+                float d = 1e30f;
+                sycl::vec<float, 4> normal;
+                for (size_t c = 0; c < count; ++c)
+                    d = sycl::min(d, collider_distance(colliders[c], pos, normal));
+                dist[idx] = d;
+            });
+        }).wait();
+        sycl::free(colliders, q);
+    }
+
+    // tris: 3 corners per triangle in device memory, placed at pos * scale + offset.
+    // a negative scale on one axis (model y up to world y down) mirrors the
+    // winding, the sign test follows it
+    void bake(const sycl::vec<float, 4> *tris, size_t triangleCount, sycl::vec<float, 4> scale, sycl::vec<float, 4> offset)
+    {
+        const size_t n = nodes();
+        offset.w() = 0.0f;
+        scale.w() = 1.0f;
+        const float facing = scale.x() * scale.y() * scale.z() < 0.0f ? -1.0f : 1.0f;
+        const sycl::vec<float, 4> origin = m_origin;
+        const float cell = m_cellSize;
+        const unsigned int nx = m_nx, ny = m_ny, nz = m_nz;
+        unsigned long long *best = sycl::malloc_device<unsigned long long>(n, q);
+        unsigned int *seed = sycl::malloc_device<unsigned int>(n, q);
+        unsigned int *seedTmp = sycl::malloc_device<unsigned int>(n, q);
+        sycl::vec<float, 4> *pseudo = sycl::malloc_device<sycl::vec<float, 4>>(triangleCount * TRI_FEATURES, q);
+        q.memset(best, 0xff, sizeof(unsigned long long) * n).wait();
+        pseudo_normals(tris, triangleCount, scale, offset, facing, pseudo);
+
+        auto corner = [=](size_t t, int c){
+            sycl::vec<float, 4> v = tris[t * 3 + c] * scale + offset;
+            v.w() = 0.0f;
+            return v;
+        };
+
+        // seeds: the nodes within a cell of a triangle keep the closest one,
+        // distance bits high and triangle low so one 64 bit min picks it
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(triangleCount), [=](sycl::id<1> idx_d){
+                size_t t = idx_d.get(0);
+                sycl::vec<float, 4> a = corner(t, 0), b = corner(t, 1), c = corner(t, 2);
+                sycl::vec<float, 4> lo = (sycl::min(a, sycl::min(b, c)) - origin) / cell;
+                sycl::vec<float, 4> hi = (sycl::max(a, sycl::max(b, c)) - origin) / cell;
+                int x0 = sycl::max((int)sycl::floor(lo.x()) - 1, 0), x1 = sycl::min((int)sycl::ceil(hi.x()) + 1, (int)nx - 1);
+                int y0 = sycl::max((int)sycl::floor(lo.y()) - 1, 0), y1 = sycl::min((int)sycl::ceil(hi.y()) + 1, (int)ny - 1);
+                int z0 = sycl::max((int)sycl::floor(lo.z()) - 1, 0), z1 = sycl::min((int)sycl::ceil(hi.z()) + 1, (int)nz - 1);
+                for (int z = z0; z <= z1; ++z)
+                for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                {
+                    sycl::vec<float, 4> p = origin + cell * sycl::vec<float, 4>((float)x, (float)y, (float)z, 0.0f);
+                    sycl::vec<float, 4> off = p - closest_on_triangle(p, a, b, c);
+                    off.w() = 0.0f;
+                    float d = sycl::length(off);
+                    if (d > cell) continue;
+                    unsigned long long key = ((unsigned long long)sycl::bit_cast<unsigned int>(d) << 32) | (unsigned long long)t;
+                    sycl::atomic_ref<unsigned long long, sycl::memory_order::relaxed, sycl::memory_scope::device> best_ref(best[((size_t)z * ny + y) * nx + x]);
+                    best_ref.fetch_min(key);
+                }
+            });
+        }).wait();
+
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                unsigned long long key = best[idx];
+                seed[idx] = key == ~0ull ? SDF_NO_TRIANGLE : (unsigned int)(key & 0xffffffffull);
+            });
+        }).wait();
+
+        // jump flood, steps res / 2 ... 1 and a last step of 1 to mop up
+        unsigned int maxRes = std::max(nx, std::max(ny, nz));
+        std::vector<unsigned int> steps;
+        for (unsigned int s = 1; s < maxRes; s <<= 1)
+            steps.insert(steps.begin(), s);
+        steps.push_back(1);
+        for (unsigned int step : steps)
+        {
+            const unsigned int *in = seed;
+            unsigned int *out = seedTmp;
+            q.submit([&](sycl::handler &h){
+                h.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx_d){
+                    size_t idx = idx_d.get(0);
+                    int x = (int)(idx % nx), y = (int)((idx / nx) % ny), z = (int)(idx / ((size_t)nx * ny));
+                    sycl::vec<float, 4> p = origin + cell * sycl::vec<float, 4>((float)x, (float)y, (float)z, 0.0f);
+                    unsigned int bestTri = in[idx];
+                    float bestD = 1e30f;
+                    if (bestTri != SDF_NO_TRIANGLE)
+                    {
+                        sycl::vec<float, 4> off = p - closest_on_triangle(p, corner(bestTri, 0), corner(bestTri, 1), corner(bestTri, 2));
+                        off.w() = 0.0f;
+                        bestD = sycl::dot(off, off);
+                    }
+                    for (int dz = -1; dz <= 1; ++dz)
+                    for (int dy = -1; dy <= 1; ++dy)
+                    for (int dx = -1; dx <= 1; ++dx)
+                    {
+                        int sx = x + dx * (int)step, sy = y + dy * (int)step, sz = z + dz * (int)step;
+                        if (sx < 0 || sy < 0 || sz < 0 || sx >= (int)nx || sy >= (int)ny || sz >= (int)nz) continue;
+                        unsigned int t = in[((size_t)sz * ny + sy) * nx + sx];
+                        if (t == SDF_NO_TRIANGLE || t == bestTri) continue;
+                        sycl::vec<float, 4> off = p - closest_on_triangle(p, corner(t, 0), corner(t, 1), corner(t, 2));
+                        off.w() = 0.0f;
+                        float d = sycl::dot(off, off);
+                        if (d < bestD)
+                        {
+                            bestD = d;
+                            bestTri = t;
+                        }
+                    }
+                    out[idx] = bestTri;
+                });
+            }).wait();
+            std::swap(seed, seedTmp);
+        }
+
+        float *dist = m_dist;
+        const unsigned int *found = seed;
+        const sycl::vec<float, 4> *normals = pseudo;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                unsigned int t = found[idx];
+                if (t == SDF_NO_TRIANGLE)
+                {
+                    dist[idx] = 1e30f;
+                    return;
+                }
+                sycl::vec<float, 4> p = origin + cell * sycl::vec<float, 4>((float)(idx % nx), (float)((idx / nx) % ny), (float)(idx / ((size_t)nx * ny)), 0.0f);
+                unsigned int feature;
+                sycl::vec<float, 4> off = p - closest_on_triangle(p, corner(t, 0), corner(t, 1), corner(t, 2), feature);
+                off.w() = 0.0f;
+                float side = sycl::dot(off, normals[t * TRI_FEATURES + feature]);
+                dist[idx] = side < 0.0f ? -sycl::length(off) : sycl::length(off);
+            });
+        }).wait();
+
+        sycl::free(best, q);
+        sycl::free(seed, q);
+        sycl::free(seedTmp, q);
+        sycl::free(pseudo, q);
+    }
+
+private:
+    // per triangle its outward face normal, then the angle weighted normals of
+    // its corners (summed over every triangle sharing the corner) and the
+    // normals of its edges (the sum of the two faces), in TRI_* order.
+    // corners are welded by their exact position, on the host: the mesh is
+    // loaded there anyway
+    void pseudo_normals(const sycl::vec<float, 4> *tris, size_t triangleCount, sycl::vec<float, 4> scale, sycl::vec<float, 4> offset,
+                        float facing, sycl::vec<float, 4> *pseudo)
+    {
+        std::vector<sycl::vec<float, 4>> host(triangleCount * 3);
+        q.memcpy(host.data(), tris, sizeof(sycl::vec<float, 4>) * host.size()).wait();
+        std::map<std::array<float, 3>, unsigned int> weld;
+        std::vector<unsigned int> vertex(host.size());
+        for (size_t i = 0; i < host.size(); ++i)
+        {
+            std::array<float, 3> key{ host[i].x(), host[i].y(), host[i].z() };
+            vertex[i] = weld.emplace(key, (unsigned int)weld.size()).first->second;
+            host[i] = host[i] * scale + offset;
+            host[i].w() = 0.0f;
+        }
+        std::vector<sycl::vec<float, 4>> face(triangleCount);
+        std::vector<sycl::vec<float, 4>> corner(weld.size(), sycl::vec<float, 4>(0.0f));
+        std::map<std::pair<unsigned int, unsigned int>, sycl::vec<float, 4>> edge;
+        auto edge_key = [](unsigned int u, unsigned int v){ return std::make_pair(std::min(u, v), std::max(u, v)); };
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            const sycl::vec<float, 4> *v = &host[t * 3];
+            sycl::vec<float, 3> e0(v[1].x() - v[0].x(), v[1].y() - v[0].y(), v[1].z() - v[0].z());
+            sycl::vec<float, 3> e1(v[2].x() - v[0].x(), v[2].y() - v[0].y(), v[2].z() - v[0].z());
+            sycl::vec<float, 3> fn = sycl::cross(e0, e1);
+            float len = sycl::length(fn);
+            face[t] = len > 0.0f ? facing * sycl::vec<float, 4>(fn.x(), fn.y(), fn.z(), 0.0f) / len : sycl::vec<float, 4>(0.0f);
+            for (int c = 0; c < 3; ++c)
+            {
+                sycl::vec<float, 4> u = v[(c + 1) % 3] - v[c], w = v[(c + 2) % 3] - v[c];
+                float lu = sycl::length(u), lw = sycl::length(w);
+                if (lu > 0.0f && lw > 0.0f)
+                    corner[vertex[t * 3 + c]] += face[t] * std::acos(std::clamp(sycl::dot(u, w) / (lu * lw), -1.0f, 1.0f));
+                edge[edge_key(vertex[t * 3 + c], vertex[t * 3 + (c + 1) % 3])] += face[t];
+            }
+        }
+        std::vector<sycl::vec<float, 4>> out(triangleCount * TRI_FEATURES);
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            const unsigned int *v = &vertex[t * 3];
+            sycl::vec<float, 4> *o = &out[t * TRI_FEATURES];
+            o[TRI_FACE] = face[t];
+            o[TRI_A] = corner[v[0]];
+            o[TRI_B] = corner[v[1]];
+            o[TRI_C] = corner[v[2]];
+            o[TRI_AB] = edge[edge_key(v[0], v[1])];
+            o[TRI_BC] = edge[edge_key(v[1], v[2])];
+            o[TRI_CA] = edge[edge_key(v[2], v[0])];
+        }
+        q.memcpy(pseudo, out.data(), sizeof(sycl::vec<float, 4>) * out.size()).wait();
+    }
+};
@@ -0,0 +1,155 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include "particle.hpp"
+#include "math.hpp"
+
+// simulation level of detail. classify() projects every live particle with
+// the camera and gives it a level of its own:
+//  - 0 visible and closer than m_distance, every frame
+//  - 1 visible and closer than 2 * m_distance, every 2nd frame
+//  - 2 visible and further, every 4th frame
+//  - 3 outside the view, every 8th frame
+// a particle that is not due this frame stores a scale of 0 and the update
+// kernel leaves it alone, a due one gets the time it has missed as a
+// multiple of this frame's dt. the pool is cut into chunks of LOD_CHUNK
+// consecutive slots only to stagger the levels over the frames, so the work
+// per frame stays even.
+// the missed time is kept per slot and starts at 0 with the particle: a slot
+// that is dead, or whose particle the update is about to kill, is reset.
+
+const size_t LOD_CHUNK = 256;
+const unsigned int LOD_LEVELS = 4;
+
+// device side, copy it into a kernel
+class LodView
+{
+public:
+    const float *m_scale{ nullptr }; // per slot, multiplies dt, 0 is skipped this frame
+    float m_reach{ 0.0f }; // host side, max of speed * scale at the last classify()
+
+    bool valid() const { return m_scale != nullptr; }
+
+    float scale(size_t idx) const { return m_scale[idx]; }
+};
+
+class SimLod
+{
+public:
+    float m_distance{ 500.0f };
+    float m_margin{ 0.1f }; // ndc, a little past the screen edge still counts as visible
+    unsigned int m_counts[LOD_LEVELS]{}; // live particles per level at the last classify(), read back only on request
+    sycl::queue q;
+private:
+    size_t m_slots;
+    unsigned char *m_level{ nullptr }; // per slot, LOD_LEVELS for a dead one
+    float *m_pending{ nullptr }; // per slot, time since the particle was last updated
+    float *m_scale{ nullptr };
+    float *m_reachDev{ nullptr };
+    float m_reach{ 0.0f };
+    unsigned int m_frame{ 0 };
+public:
+    SimLod(size_t maxParticles): q(sycl::gpu_selector_v)
+    {
+        m_slots = maxParticles > 0 ? maxParticles : 1;
+        m_level = sycl::malloc_device<unsigned char>(m_slots, q);
+        m_pending = sycl::malloc_device<float>(m_slots, q);
+        m_scale = sycl::malloc_device<float>(m_slots, q);
+        m_reachDev = sycl::malloc_device<float>(1, q);
+        q.memset(m_level, LOD_LEVELS, m_slots);
+        q.memset(m_pending, 0, sizeof(float) * m_slots);
+        q.memset(m_scale, 0, sizeof(float) * m_slots);
+        q.wait();
+    }
+    SimLod(const SimLod &) = delete;
+    SimLod &operator=(const SimLod &) = delete;
+    ~SimLod()
+    {
+        sycl::free(m_level, q);
+        sycl::free(m_pending, q);
+        sycl::free(m_scale, q);
+        sycl::free(m_reachDev, q);
+    }
+
+    LodView view() const
+    {
+        return LodView{ m_scale, m_reach };
+    }
+
+    // once per frame before the update, viewProj and eye of the frame being drawn.
+    // hand view() to the updater again afterwards, m_reach sizes its substeps
+    void classify(double dt, const Mat4x4 &viewProj, const sycl::vec<float, 3> &eye, Particle_system &p)
+    {
+        const unsigned int endId = p.m_highWater;
+        m_reach = 0.0f;
+        if (endId == 0)
+            return;
+        const Mat4x4 vp = viewProj;
+        const sycl::vec<float, 4> eye4(eye.x(), eye.y(), eye.z(), 0.0f);
+        const float nearDist = m_distance;
+        const float edge = 1.0f + m_margin;
+        const float frameDt = (float)dt;
+        const unsigned int frame = m_frame++;
+        unsigned char *level = m_level;
+        float *pending = m_pending;
+        float *scale = m_scale;
+        q.memset(m_reachDev, 0, sizeof(float)).wait();
+        q.submit([&](sycl::handler &h){
+            auto buf_acc = p.m_particle;
+            auto alive_acc = p.m_alive;
+            auto reach_reduce = sycl::reduction(m_reachDev, sycl::maximum<float>());
+            h.parallel_for(sycl::range<1>(endId), reach_reduce, [=](sycl::id<1> id, auto &maxReach){
+                size_t idx = id.get(0);
+                scale[idx] = 0.0f;
+                // the update kills a particle whose time ran out before it looks at the scale
+                if (alive_acc[idx] == 0 || buf_acc[idx].time.x() < 0.0f)
+                {
+                    level[idx] = (unsigned char)LOD_LEVELS;
+                    pending[idx] = 0.0f;
+                    return;
+                }
+                sycl::vec<float, 4> pos = buf_acc[idx].pos;
+                pos.w() = 1.0f;
+                sycl::vec<float, 4> clip = vp * pos;
+                unsigned int mine = LOD_LEVELS - 1;
+                // w is the depth in front of the camera
+                bool visible = clip.w() > 0.0f && sycl::fabs(clip.x()) <= edge && sycl::fabs(clip.y()) <= edge;
+                if (visible)
+                {
+                    sycl::vec<float, 4> off = pos - eye4;
+                    off.w() = 0.0f;
+                    float d = sycl::length(off);
+                    mine = d < nearDist ? 0 : (d < 2.0f * nearDist ? 1 : 2);
+                }
+                level[idx] = (unsigned char)mine;
+                float waited = pending[idx] + frameDt;
+                // staggered by chunk index
+                const unsigned int c = (unsigned int)(idx / LOD_CHUNK);
+                bool due = ((frame + c) & ((1u << mine) - 1)) == 0 && frameDt > 0.0f;
+                if (due)
+                {
+                    float s = waited / frameDt;
+                    scale[idx] = s;
+                    pending[idx] = 0.0f;
+                    maxReach.combine(sycl::length(buf_acc[idx].vel) * s);
+                }
+                else
+                    pending[idx] = waited;
+            });
+        }).wait();
+        q.copy<float>(m_reachDev, &m_reach, 1).wait();
+    }
+
+    // live particles per level into m_counts, for the overlay
+    void count_levels(size_t highWater)
+    {
+        std::vector<unsigned char> host(highWater);
+        if (highWater > 0)
+            q.memcpy(host.data(), m_level, highWater).wait();
+        for (unsigned int l = 0; l < LOD_LEVELS; ++l)
+            m_counts[l] = 0;
+        for (unsigned char l : host)
+            if (l < LOD_LEVELS)
+                m_counts[l]++;
+    }
+};
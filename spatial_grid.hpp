@@ -0,0 +1,175 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include "particle.hpp"
+#include "parallel_sycl_sorting.hpp"
+
+// uniform grid over the live particles, hashed into m_tableSize buckets so
+// the world needs no bounds. built on the device every frame by a counting
+// sort: count per bucket (the atomic also hands out the rank inside the
+// bucket), exclusive scan, scatter. all buffers are kept between builds and
+// only grow with the pool, a rebuild is three passes and no allocation.
+
+const unsigned int GRID_NO_CELL = 0xffffffffu;
+
+// device side, copy it into a kernel
+class GridView
+{
+public:
+    const unsigned int *m_cellStart{ nullptr }; // m_tableSize + 1 entries, bucket h is [start[h], start[h + 1])
+    const unsigned int *m_sorted{ nullptr };    // particle slots in bucket order
+    sycl::vec<float, 4> m_origin{ 0.0f };
+    float m_cellSize{ 1.0f };
+    unsigned int m_tableSize{ 0 }; // power of two
+
+    sycl::vec<int, 4> cell(const sycl::vec<float, 4> &pos) const
+    {
+        return sycl::vec<int, 4>((int)sycl::floor((pos.x() - m_origin.x()) / m_cellSize),
+                                 (int)sycl::floor((pos.y() - m_origin.y()) / m_cellSize),
+                                 (int)sycl::floor((pos.z() - m_origin.z()) / m_cellSize), 0);
+    }
+
+    unsigned int hash(int x, int y, int z) const
+    {
+        return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ (unsigned int)z * 83492791u) & (m_tableSize - 1);
+    }
+
+    unsigned int hash(const sycl::vec<float, 4> &pos) const
+    {
+        sycl::vec<int, 4> c = cell(pos);
+        return hash(c.x(), c.y(), c.z());
+    }
+
+    // calls f(slot) for every particle of the 27 cells around pos, pos's own
+    // particle included. buckets shared by two of those cells are visited
+    // once, particles of far cells hashed into them can still show up so f
+    // has to check the distance anyway.
+    template<class F>
+    void for_each_neighbour(const sycl::vec<float, 4> &pos, F f) const
+    {
+        sycl::vec<int, 4> c = cell(pos);
+        unsigned int seen[27];
+        unsigned int seenCount = 0;
+        for (int dz = -1; dz <= 1; ++dz)
+        for (int dy = -1; dy <= 1; ++dy)
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            unsigned int h = hash(c.x() + dx, c.y() + dy, c.z() + dz);
+            bool dup = false;
+            for (unsigned int s = 0; s < seenCount; ++s)
+                dup = dup || seen[s] == h;
+            if (dup) continue;
+            seen[seenCount++] = h;
+            for (unsigned int i = m_cellStart[h]; i < m_cellStart[h + 1]; ++i)
+                f(m_sorted[i]);
+        }
+    }
+};
+
+class SpatialGrid
+{
+public:
+    sycl::vec<float, 4> m_origin{ 0.0f };
+    float m_cellSize{ 10.0f }; // at least the interaction radius
+    sycl::queue q;
+    unsigned int *m_keys{ nullptr };   // bucket of every slot, GRID_NO_CELL when dead
+    unsigned int *m_sorted{ nullptr };
+    unsigned int *m_cellStart{ nullptr };
+    unsigned int m_sortedCount{ 0 };   // live particles in the last build
+private:
+    unsigned int *m_rank{ nullptr };
+    unsigned int *m_counts{ nullptr };
+    unsigned int *m_scratch{ nullptr };
+    unsigned int m_tableSize;
+    size_t m_capacity{ 0 };
+public:
+    // tableSize is rounded up to a power of two, about the number of particles works well
+    SpatialGrid(float cellSize = 10.0f, unsigned int tableSize = 1u << 20, const sycl::device &device = sycl::device(sycl::gpu_selector_v)): m_cellSize(cellSize), q(device)
+    {
+        m_tableSize = 1;
+        while (m_tableSize < tableSize) m_tableSize <<= 1;
+        m_counts = sycl::malloc_device<unsigned int>(m_tableSize, q);
+        m_cellStart = sycl::malloc_device<unsigned int>(m_tableSize + 1, q);
+        m_scratch = sycl::malloc_device<unsigned int>(device_scan_scratch(m_tableSize), q);
+    }
+    SpatialGrid(const SpatialGrid &) = delete;
+    SpatialGrid &operator=(const SpatialGrid &) = delete;
+    ~SpatialGrid()
+    {
+        release();
+        sycl::free(m_counts, q);
+        sycl::free(m_cellStart, q);
+        sycl::free(m_scratch, q);
+    }
+
+    GridView view() const
+    {
+        return GridView{ m_cellStart, m_sorted, m_origin, m_cellSize, m_tableSize };
+    }
+
+    void build(Particle_system &p)
+    {
+        const size_t endId = p.m_highWater;
+        if (endId > m_capacity)
+        {
+            release();
+            m_capacity = p.size; // once, the pool never gets bigger than that
+            m_keys = sycl::malloc_device<unsigned int>(m_capacity, q);
+            m_rank = sycl::malloc_device<unsigned int>(m_capacity, q);
+            m_sorted = sycl::malloc_device<unsigned int>(m_capacity, q);
+        }
+        q.memset(m_counts, 0, sizeof(unsigned int) * m_tableSize).wait();
+        if (endId == 0)
+        {
+            q.memset(m_cellStart, 0, sizeof(unsigned int) * (m_tableSize + 1)).wait();
+            m_sortedCount = 0;
+            return;
+        }
+
+        const GridView grid = view();
+        unsigned int *keys = m_keys;
+        unsigned int *rank = m_rank;
+        unsigned int *counts = m_counts;
+        q.submit([&](sycl::handler &h){
+            auto buf_acc = p.m_particle;
+            auto alive_acc = p.m_alive;
+            h.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if (alive_acc[idx] == 0)
+                {
+                    keys[idx] = GRID_NO_CELL;
+                    return;
+                }
+                unsigned int key = grid.hash(buf_acc[idx].pos);
+                keys[idx] = key;
+                sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device> count_ref(counts[key]);
+                rank[idx] = count_ref.fetch_add(1u);
+            });
+        }).wait();
+
+        device_exclusive_scan(q, m_counts, m_cellStart, m_tableSize, m_scratch);
+
+        const unsigned int *start = m_cellStart;
+        unsigned int *sorted = m_sorted;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                unsigned int key = keys[idx];
+                if (key == GRID_NO_CELL) return;
+                sorted[start[key] + rank[idx]] = (unsigned int)idx;
+            });
+        }).wait();
+        q.copy<unsigned int>(m_cellStart + m_tableSize, &m_sortedCount, 1).wait();
+    }
+
+private:
+    void release()
+    {
+        if (m_keys) sycl::free(m_keys, q);
+        if (m_rank) sycl::free(m_rank, q);
+        if (m_sorted) sycl::free(m_sorted, q);
+        m_keys = nullptr;
+        m_rank = nullptr;
+        m_sorted = nullptr;
+        m_capacity = 0;
+    }
+};
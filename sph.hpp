@@ -0,0 +1,179 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <cmath>
+#include "particle.hpp"
+#include "spatial_grid.hpp"
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// smoothed-particle hydrodynamics after Müller et al. 2003: poly6 density,
+// spiky pressure gradient, viscosity laplacian and optional XSPH velocity
+// smoothing. the neighbours come from a SpatialGrid with cells of size h.
+// densities are normalised so particles m_spacing * h apart are at rest
+// (density 1), which keeps the stiffness independent of the world scale.
+// the solver only changes velocities, EulerUpdater still moves the particles
+// and handles the floor, so run it right before eu.update().
+class SphSolver
+{
+public:
+    float m_h{ 10.0f };          // smoothing radius
+    float m_spacing{ 0.5f };     // rest spacing, fraction of h
+    float m_stiffness{ 20000.0f };
+    float m_viscosity{ 20.0f };
+    float m_xsph{ 0.1f };        // 0 turns the smoothing off
+    sycl::vec<float, 4> m_gravity{ 0.0f, 200.0f, 0.0f, 0.0f }; // +y is down
+    float m_floorY{ 1000.0f }; // keep in sync with the updater, pressure would push the fluid through it
+    float m_mass{ 1.0f };        // set by calibrate()
+    SpatialGrid m_grid;
+    sycl::queue q;
+private:
+    float *m_density{ nullptr };
+    sycl::vec<float, 4> *m_newVel{ nullptr };
+    size_t m_capacity{ 0 };
+public:
+    SphSolver(unsigned int tableSize = 1u << 20, const sycl::device &device = sycl::device(sycl::gpu_selector_v)): m_grid(10.0f, tableSize, device), q(device)
+    {
+        calibrate();
+    }
+    SphSolver(const SphSolver &) = delete;
+    SphSolver &operator=(const SphSolver &) = delete;
+    ~SphSolver()
+    {
+        release();
+    }
+
+    // particle mass giving density 1 on a cubic lattice at the rest spacing,
+    // call again after changing m_h or m_spacing
+    void calibrate()
+    {
+        m_grid.m_cellSize = m_h;
+        double sum = 0.0;
+        double s = m_spacing * m_h;
+        int n = (int)std::ceil(1.0 / m_spacing);
+        for (int z = -n; z <= n; ++z)
+        for (int y = -n; y <= n; ++y)
+        for (int x = -n; x <= n; ++x)
+            sum += poly6((float)((x * x + y * y + z * z) * s * s), m_h);
+        m_mass = (float)(1.0 / sum);
+    }
+
+    void update(double dt, Particle_system &p)
+    {
+        const size_t endId = p.m_highWater;
+        if (endId == 0) return;
+        if (endId > m_capacity)
+        {
+            release();
+            m_capacity = p.size;
+            m_density = sycl::malloc_device<float>(m_capacity, q);
+            m_newVel = sycl::malloc_device<sycl::vec<float, 4>>(m_capacity, q);
+        }
+        m_grid.build(p);
+
+        const GridView grid = m_grid.view();
+        const float h = m_h;
+        const float mass = m_mass;
+        const float stiffness = m_stiffness;
+        const float viscosity = m_viscosity;
+        const float xsph = m_xsph;
+        const float localDT = (float)dt;
+        const sycl::vec<float, 4> gravity = m_gravity;
+        const float floorY = m_floorY;
+        float *density = m_density;
+        sycl::vec<float, 4> *newVel = m_newVel;
+        Particle *buf_acc = p.m_particle;
+        const unsigned char *alive_acc = p.m_alive;
+
+        // density, the particle itself included
+        q.submit([&](sycl::handler &h_){
+            h_.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if (alive_acc[idx] == 0) return;
+                const sycl::vec<float, 4> pi = buf_acc[idx].pos;
+                float rho = 0.0f;
+                grid.for_each_neighbour(pi, [&](unsigned int j){
+                    sycl::vec<float, 4> d = pi - buf_acc[j].pos;
+                    rho += poly6(d.x() * d.x() + d.y() * d.y() + d.z() * d.z(), h);
+                });
+                density[idx] = rho * mass;
+            });
+        }).wait();
+
+        // pressure, viscosity and xsph from the old velocities into newVel
+        q.submit([&](sycl::handler &h_){
+            h_.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if (alive_acc[idx] == 0) return;
+                const sycl::vec<float, 4> pi = buf_acc[idx].pos;
+                const sycl::vec<float, 4> vi = buf_acc[idx].vel;
+                const float rhoi = density[idx];
+                // no negative pressure, it would clump the particles
+                const float presi = stiffness * sycl::max(rhoi - 1.0f, 0.0f);
+                sycl::vec<float, 4> force(0.0f);
+                sycl::vec<float, 4> smooth(0.0f);
+                grid.for_each_neighbour(pi, [&](unsigned int j){
+                    if (j == idx) return;
+                    sycl::vec<float, 4> d = pi - buf_acc[j].pos;
+                    d.w() = 0.0f;
+                    float r2 = sycl::dot(d, d);
+                    if (r2 >= h * h || r2 < 1e-12f) return;
+                    float r = sycl::sqrt(r2);
+                    float rhoj = density[j];
+                    float presj = stiffness * sycl::max(rhoj - 1.0f, 0.0f);
+                    sycl::vec<float, 4> dv = buf_acc[j].vel - vi;
+                    force += d * (-mass * (presi + presj) / (2.0f * rhoj) * spiky_grad(r, h) / r);
+                    force += dv * (viscosity * mass / rhoj * visc_laplacian(r, h));
+                    smooth += dv * (mass * 2.0f / (rhoi + rhoj) * poly6(r2, h));
+                });
+                sycl::vec<float, 4> v = vi + localDT * (force / rhoi + gravity) + xsph * smooth;
+                v.w() = vi.w();
+                newVel[idx] = v;
+            });
+        }).wait();
+
+        q.submit([&](sycl::handler &h_){
+            h_.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if (alive_acc[idx] == 0) return;
+                buf_acc[idx].vel = newVel[idx];
+                // the updater only reflects the velocity, a resting column would sink
+                if (buf_acc[idx].pos.y() > floorY)
+                {
+                    buf_acc[idx].pos.y() = floorY;
+                    buf_acc[idx].vel.y() = sycl::min(buf_acc[idx].vel.y(), 0.0f);
+                }
+            });
+        }).wait();
+    }
+
+    static float poly6(float r2, float h)
+    {
+        float h2 = h * h;
+        if (r2 >= h2) return 0.0f;
+        float x = h2 - r2;
+        return 315.0f / (64.0f * (float)M_PI * h2 * h2 * h2 * h2 * h) * x * x * x;
+    }
+
+    // magnitude of the spiky kernel gradient, the direction is -d / r
+    static float spiky_grad(float r, float h)
+    {
+        float x = h - r;
+        return -45.0f / ((float)M_PI * h * h * h * h * h * h) * x * x;
+    }
+
+    static float visc_laplacian(float r, float h)
+    {
+        return 45.0f / ((float)M_PI * h * h * h * h * h * h) * (h - r);
+    }
+
+private:
+    void release()
+    {
+        if (m_density) sycl::free(m_density, q);
+        if (m_newVel) sycl::free(m_newVel, q);
+        m_density = nullptr;
+        m_newVel = nullptr;
+        m_capacity = 0;
+    }
+};
@@ -0,0 +1,131 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include "particle.hpp"
+#include "my_random.hpp"
+
+// secondary emission driven by the gpu: the update kernel pushes a request
+// for every floor hit into a device append buffer, the next SplashEmitter
+// pass turns them into child particles. the host never sees the requests.
+
+class SplashRequest
+{
+public:
+    sycl::vec<float, 4> pos; // where the parent hit the floor
+    sycl::vec<float, 4> col; // parent color at the hit
+    float speed;              // parent speed into the floor
+};
+
+// what a kernel needs to append requests, requests past m_capacity are dropped
+class SplashSink
+{
+public:
+    SplashRequest *m_requests{ nullptr };
+    unsigned int *m_count{ nullptr };
+    unsigned int m_capacity{ 0 };
+
+    bool valid() const { return m_requests != nullptr; }
+
+    void push(const SplashRequest &r) const
+    {
+        sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device> count_ref(*m_count);
+        unsigned int slot = count_ref.fetch_add(1u);
+        if (slot < m_capacity)
+            m_requests[slot] = r;
+    }
+};
+
+// owns the append buffer and spawns m_children particles per request into
+// dead slots below the high-water mark. the number of requests is only known
+// on the device so the pool never grows for splashes, when no dead slot is
+// left the rest of the splashes of that frame are dropped.
+class SplashEmitter
+{
+public:
+    unsigned int m_children{ 4 };
+    float m_speedScale{ 0.3f }; // child speed relative to the impact speed
+    float m_minTime{ 0.5f };
+    float m_maxTime{ 1.5f };
+    unsigned long long m_seed{ 0 };
+    unsigned int m_frame{ 0 }; // philox counter, bumped once per generate()
+    sycl::queue q;
+private:
+    SplashRequest *m_requests{ nullptr };
+    unsigned int *m_count{ nullptr };
+    unsigned int *m_claimed{ nullptr };
+    unsigned int m_capacity{ 0 };
+public:
+    SplashEmitter(unsigned int capacity = 65536): q(sycl::gpu_selector_v), m_capacity(capacity)
+    {
+        m_requests = sycl::malloc_device<SplashRequest>(capacity, q);
+        m_count = sycl::malloc_device<unsigned int>(1, q);
+        m_claimed = sycl::malloc_device<unsigned int>(1, q);
+        q.memset(m_count, 0, sizeof(unsigned int));
+        q.memset(m_claimed, 0, sizeof(unsigned int));
+        q.wait();
+    }
+    SplashEmitter(const SplashEmitter &) = delete;
+    SplashEmitter &operator=(const SplashEmitter &) = delete;
+    ~SplashEmitter()
+    {
+        sycl::free(m_requests, q);
+        sycl::free(m_count, q);
+        sycl::free(m_claimed, q);
+    }
+
+    // hand this to the updater
+    SplashSink sink() const
+    {
+        return SplashSink{ m_requests, m_count, m_capacity };
+    }
+
+    // consumes every pending request and empties the buffer, all on the device
+    void generate(Particle_system &p)
+    {
+        if (p.m_highWater == 0) return;
+        const SplashRequest *requests = m_requests;
+        unsigned int *count = m_count;
+        unsigned int *claimed = m_claimed;
+        const unsigned int capacity = m_capacity;
+        const unsigned int children = m_children;
+        const float speedScale = m_speedScale;
+        const float minTime = m_minTime;
+        const float maxTime = m_maxTime;
+        const unsigned long long seed = m_seed;
+        const unsigned int frame = m_frame++;
+        q.submit([&](sycl::handler &h){
+            auto buf_acc = p.m_particle;
+            auto alive_acc = p.m_alive;
+            h.parallel_for(sycl::range<1>(p.m_highWater), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                const unsigned int wanted = sycl::min(*count, capacity) * children;
+                if (alive_acc[idx] != 0 || *claimed >= wanted) return;
+                sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device> claim_ref(*claimed);
+                unsigned int rank = claim_ref.fetch_add(1u);
+                if (rank >= wanted) return;
+
+                const SplashRequest r = requests[rank / children];
+                // up and away from the floor (-y is up), a cone around the normal
+                sycl::vec<float, 4> u = philox_randf(seed, idx, frame, STREAM_SPLASH_VEL);
+                float ang = u.x() * (float)(M_PI * 2.0);
+                float spread = u.y() * 0.8f;
+                float speed = r.speed * speedScale * (0.5f + u.z());
+                Particle pt;
+                pt.pos = r.pos;
+                pt.vel = sycl::vec<float, 4>(speed * spread * sycl::cos(ang), -speed, speed * spread * sycl::sin(ang), 0.0f);
+                pt.acc = sycl::vec<float, 4>(0.0f);
+                pt.startCol = r.col;
+                pt.endCol = r.col;
+                pt.col = r.col;
+                pt.time.x() = pt.time.y() = philox_randf(seed, idx, frame, STREAM_SPLASH_TIME).x() * (maxTime - minTime) + minTime;
+                pt.time.z() = 0.0f;
+                pt.time.w() = 1.0f / pt.time.x();
+                buf_acc[idx] = pt;
+                alive_acc[idx] = 1;
+            });
+        }).wait();
+        q.single_task([=](){
+            *count = 0;
+            *claimed = 0;
+        }).wait();
+    }
+};
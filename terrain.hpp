@@ -0,0 +1,113 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <iostream>
+#include "./include/raylib.h"
+
+// uneven ground from a heightmap image: a grid of heights over
+// [m_originX, m_originX + m_size] x [m_originZ, m_originZ + m_size], the
+// first pixel at the lowest corner. white is m_heightScale above the floor
+// (toward -y), black is the floor itself. the update kernel takes a bilinear
+// height and the normal of the same bilinear patch, outside the map the
+// ground is the flat floor.
+
+// device side, copy it into a kernel
+class TerrainView
+{
+public:
+    const float *m_height{ nullptr }; // 0..1 per node
+    float m_originX{ 0.0f };
+    float m_originZ{ 0.0f };
+    float m_cellX{ 1.0f };
+    float m_cellZ{ 1.0f };
+    unsigned int m_nx{ 0 }, m_nz{ 0 };
+    float m_heightScale{ 0.0f };
+
+    bool valid() const { return m_height != nullptr; }
+
+    // ground y under (x, z), into is the unit vector pointing into the ground
+    // (+y on flat ground, the updater's floor direction)
+    float ground(float x, float z, float floorY, sycl::vec<float, 4> &into) const
+    {
+        into = sycl::vec<float, 4>(0.0f, 1.0f, 0.0f, 0.0f);
+        float fx = (x - m_originX) / m_cellX;
+        float fz = (z - m_originZ) / m_cellZ;
+        if (!(fx >= 0.0f && fz >= 0.0f && fx < (float)(m_nx - 1) && fz < (float)(m_nz - 1)))
+            return floorY;
+        unsigned int i = (unsigned int)fx, k = (unsigned int)fz;
+        float tx = fx - i, tz = fz - k;
+        float h00 = m_height[(size_t)k * m_nx + i], h10 = m_height[(size_t)k * m_nx + i + 1];
+        float h01 = m_height[(size_t)(k + 1) * m_nx + i], h11 = m_height[(size_t)(k + 1) * m_nx + i + 1];
+        float h0 = h00 + (h10 - h00) * tx, h1 = h01 + (h11 - h01) * tx;
+        float h = h0 + (h1 - h0) * tz;
+        // y = floorY - h * scale, its slopes along x and z
+        float dx = -m_heightScale * ((h10 - h00) * (1.0f - tz) + (h11 - h01) * tz) / m_cellX;
+        float dz = -m_heightScale * (h1 - h0) / m_cellZ;
+        into = sycl::vec<float, 4>(-dx, 1.0f, -dz, 0.0f);
+        into /= sycl::length(into);
+        return floorY - h * m_heightScale;
+    }
+};
+
+class Terrain
+{
+public:
+    float m_originX{ -800.0f };
+    float m_originZ{ -800.0f };
+    float m_size{ 1600.0f };
+    float m_heightScale{ 300.0f };
+    sycl::queue q;
+private:
+    float *m_height{ nullptr };
+    int m_width{ 0 };
+    int m_depth{ 0 };
+public:
+    Terrain(): q(sycl::gpu_selector_v) {}
+    Terrain(const Terrain &) = delete;
+    Terrain &operator=(const Terrain &) = delete;
+    ~Terrain()
+    {
+        if (m_height) sycl::free(m_height, q);
+    }
+
+    TerrainView view() const
+    {
+        if (m_height == nullptr) return TerrainView{};
+        return TerrainView{ m_height, m_originX, m_originZ, m_size / (float)(m_width - 1), m_size / (float)(m_depth - 1),
+                            (unsigned int)m_width, (unsigned int)m_depth, m_heightScale };
+    }
+
+    bool load(const char *path)
+    {
+        Image im = LoadImage(path);
+        if (im.data == nullptr)
+        {
+            std::cout << "could not load heightmap: " << path << "\n";
+            return false;
+        }
+        bool ok = load(im);
+        UnloadImage(im);
+        return ok;
+    }
+
+    bool load(Image im)
+    {
+        if (im.width < 2 || im.height < 2)
+        {
+            std::cout << "heightmap needs at least 2x2 pixels\n";
+            return false;
+        }
+        // one float per pixel keeps the precision of 16 bit maps
+        Image copy = ImageCopy(im);
+        ImageFormat(&copy, PIXELFORMAT_UNCOMPRESSED_R32);
+        size_t count = (size_t)copy.width * copy.height;
+        std::vector<float> heights((const float *)copy.data, (const float *)copy.data + count);
+        m_width = copy.width;
+        m_depth = copy.height;
+        UnloadImage(copy);
+        if (m_height) sycl::free(m_height, q);
+        m_height = sycl::malloc_device<float>(count, q);
+        q.memcpy(m_height, heights.data(), sizeof(float) * count).wait();
+        return true;
+    }
+};
@@ -1,198 +1,329 @@
 #pragma once
 #include "particle.hpp"
+#include "my_random.hpp"
+#include "curve.hpp"
+#include "splash.hpp"
+#include "attractors.hpp"
+#include "barnes_hut.hpp"
+#include "pm_solver.hpp"
+#include "wind_grid.hpp"
+#include "colliders.hpp"
+#include "sdf_collider.hpp"
+#include "mesh_collider.hpp"
+#include "terrain.hpp"
+#include "curl_noise.hpp"
+#include "updater_chain.hpp"
+#include "sim_lod.hpp"
 #include <sycl/sycl.hpp>
+#include <cmath>
+#include <algorithm>
+#include <string>
 
-sycl::vec<float, 4> random_vec(sycl::vec<float, 4> min, sycl::vec<float, 4> max, unsigned int time);
+// how EulerUpdater moves a particle through a step. the forces it sees are
+// the particle's acc and the curl turbulence, the other force passes kick
+// the velocity once per step.
+enum Integrator : unsigned int
+{
+    INTEGRATOR_EXPLICIT,      // position with the old velocity, then the velocity
+    INTEGRATOR_SEMI_IMPLICIT, // velocity first, then the position with it (symplectic euler)
+    INTEGRATOR_VERLET,        // velocity verlet, forces at both ends of the step
+    INTEGRATOR_RK2,           // midpoint, for forces that change fast along the path
+    INTEGRATOR_COUNT
+};
 
-class ParticleUpdater
+inline const char *integrator_name(Integrator integrator)
 {
-public:
-    ParticleUpdater() { }
-     ~ParticleUpdater() { }
+    static const char *names[INTEGRATOR_COUNT] = { "euler", "semi", "verlet", "rk2" };
+    return integrator < INTEGRATOR_COUNT ? names[integrator] : "";
+}
 
-     void update(double dt, Particle_system &p);
-};
+inline bool integrator_from_name(const std::string &name, Integrator &integrator)
+{
+    for (unsigned int i = 0; i < INTEGRATOR_COUNT; ++i)
+    {
+        if (name == integrator_name((Integrator)i))
+        {
+            integrator = (Integrator)i;
+            return true;
+        }
+    }
+    return false;
+}
 
 class EulerUpdater
 {
 public:
     sycl::vec<float, 4> m_globalAcceleration;
     float m_floorY{ 1000.0f };
+    TerrainView m_terrain; // heightmap on top of the floor when set
+    CurlView m_curl; // turbulence looked up in the kernel when set
 	float m_bounceFactor{ 2.0f };
     float acc_min{ -50.0f };
     float acc_max{ 50.0f };
     size_t countAlive;
     size_t *buf_countAlive;
-    // std::vector<sycl::vec<float, 4>> m_attractors; // .w is force
+    unsigned long long m_seed{ 0 };
+    unsigned int m_frame{ 0 }; // philox counter, bumped once per update()
+    float m_time{ 0.0f }; // simulation time
+    Curve m_accCurve; // .x is acc_min, .y is acc_max, evaluated in the kernel when set
+    SplashSink m_splash; // floor hits faster than m_splashSpeed request a splash when set
+    float m_splashSpeed{ 100.0f };
+    AttractorField *m_attractors{ nullptr }; // applied in its own pass before the integration when set
+    BarnesHut *m_nbody{ nullptr }; // particle to particle gravity, same
+    PmSolver *m_pm{ nullptr }; // particle-mesh gravity, same
+    WindGrid *m_windGrid{ nullptr }; // air pushing the drops around, same
+    ColliderSet *m_colliders{ nullptr }; // tested in one pass after the integration when set
+    SdfView m_sdf; // baked static scene, looked up in the kernel when set
+    float m_sdfBounce{ 0.3f };
+    float m_sdfFriction{ 0.1f };
+    MeshView m_mesh; // triangle mesh, the step of every particle is traced through its bvh when set
+    float m_meshBounce{ 0.3f };
+    float m_meshFriction{ 0.1f };
+    LodView m_lod; // particles classified by SimLod are stepped less often with a longer dt when set
+    Integrator m_integrator{ INTEGRATOR_SEMI_IMPLICIT };
+    float m_cflDistance{ 0.0f }; // most a particle may move in one step, 0 is one step per frame
+    unsigned int m_maxSubsteps{ 8 };
+    float m_maxSpeed{ 0.0f }; // of the last step, times the lod scale: how far a particle gets per second of step
+    unsigned int m_substeps{ 0 }; // taken by the last update()
+    float *buf_maxSpeed;
     sycl::queue q;
-public:
-    // size_t collectionSize() const { return m_attractors.size(); }
-	// void add(const sycl::vec<float, 4> &attr) { m_attractors.push_back(attr); }
-	// sycl::vec<float, 4> &get(size_t id) { return m_attractors[id]; }
 public:
     EulerUpdater(): q(sycl::gpu_selector_v), countAlive(0), buf_countAlive(nullptr){
         buf_countAlive = sycl::malloc_device<size_t>(1, q);
+        buf_maxSpeed = sycl::malloc_device<float>(1, q);
         q.memset(buf_countAlive, 0, sizeof(size_t)).wait(); 
-        // m_attractors.push_back({15, 4, -3, 10}); 
-        // m_attractors.push_back({-1, 20, 13, 10});
-        // m_attractors.push_back({-10, 0, 0, 10});
     }
     ~EulerUpdater() {
         sycl::free(buf_countAlive, q);
+        sycl::free(buf_maxSpeed, q);
     }
-     void update(double dt, Particle_system &p) 
+    // one frame: a single step, or with m_cflDistance > 0 as many as it
+    // takes for the fastest particle to move at most m_cflDistance per step
+    // (up to m_maxSubsteps). the max speed comes out of the update kernel
+    // itself, each step is sized from the one before it. with a lod a due
+    // particle moves scale times as far, the first step of the frame is sized
+    // from what SimLod::classify() measured with this frame's scales.
+    void update(double dt, Particle_system &p)
     {
         // if(p.m_countAlive == 0) return;
-        unsigned int current_time = time(0);
-        m_globalAcceleration = random_vec(sycl::vec<float, 4>(acc_min), sycl::vec<float, 4>(acc_max), current_time);
-        const sycl::vec<float, 4> globalA{ dt * m_globalAcceleration.x(), 
-                                 dt * m_globalAcceleration.y(), 
-                                 dt * m_globalAcceleration.z(), 
-                                 0.0 };
-        const float localDT = (float)dt;
+        m_globalAcceleration = philox_rangef(sycl::vec<float, 4>(acc_min), sycl::vec<float, 4>(acc_max), m_seed, 0, m_frame++, STREAM_GLOBAL_ACC);
+        // nothing was ever handed out yet
+        if(p.m_highWater == 0)
+        {
+            p.m_countAlive = 0;
+            return;
+        }
+        float left = (float)dt;
+        m_substeps = 0;
+        if (m_lod.valid())
+            m_maxSpeed = m_lod.m_reach;
+        while (left > 0.0f)
+        {
+            unsigned int steps = 1;
+            if (m_cflDistance > 0.0f && m_substeps + 1 < m_maxSubsteps)
+            {
+                float need = std::ceil(left * m_maxSpeed / m_cflDistance);
+                steps = (unsigned int)std::min(std::max(need, 1.0f), (float)(m_maxSubsteps - m_substeps));
+            }
+            float stepDt = left / (float)steps;
+            step(stepDt, (float)dt, m_substeps == 0, p);
+            left = steps == 1 ? 0.0f : left - stepDt;
+            m_substeps++;
+        }
+    }
+
+private:
+    // the gusts are a per frame kick of frameDt on the first one
+    void step(float stepDt, float frameDt, bool first, Particle_system &p)
+    {
+        const sycl::vec<float, 4> globalA = first ? sycl::vec<float, 4>{ frameDt * m_globalAcceleration.x(),
+                                                                        frameDt * m_globalAcceleration.y(),
+                                                                        frameDt * m_globalAcceleration.z(),
+                                                                        0.0f } : sycl::vec<float, 4>(0.0f);
+        const float gustDT = first ? frameDt : 0.0f;
+        const float baseDT = stepDt;
+        m_time += baseDT;
+        const Curve accCurve = m_accCurve;
+        const float time = m_time;
+        const unsigned long long seed = m_seed;
+        const unsigned int frame = m_frame - 1;
+        const Integrator integrator = m_integrator;
     
-        const unsigned int endId = p.size;
+        const unsigned int endId = p.m_highWater;
                 
-        // if(p.m_countAlive == 0) return;
+        if(m_attractors)
+            m_attractors->apply(stepDt, p);
+        if(m_nbody)
+            m_nbody->update(stepDt, p);
+        if(m_pm)
+            m_pm->update(stepDt, p);
+        if(m_windGrid)
+            m_windGrid->update(stepDt, p);
         float m_floorY = this->m_floorY;
         float m_bounceFactor = this->m_bounceFactor;
-        q.memset(buf_countAlive, 0, sizeof(size_t)).wait(); 
+        const SplashSink splash = m_splash;
+        const float splashSpeed = m_splashSpeed;
+        const TerrainView terrain = m_terrain;
+        const CurlView curl = m_curl;
+        const SdfView sdf = m_sdf;
+        const float sdfBounce = m_sdfBounce;
+        const float sdfFriction = m_sdfFriction;
+        const MeshView mesh = m_mesh;
+        const float meshBounce = m_meshBounce;
+        const float meshFriction = m_meshFriction;
+        const LodView lod = m_lod;
+        q.memset(buf_countAlive, 0, sizeof(size_t));
+        q.memset(buf_maxSpeed, 0, sizeof(float));
+        q.wait();
         q.submit([&](sycl::handler &h){
             auto buf_acc = p.m_particle;
+            auto alive_acc = p.m_alive;
             auto count_reduce = sycl::reduction(buf_countAlive, sycl::plus<>());
-            h.parallel_for(sycl::range<1>(p.size), count_reduce, [=](sycl::id<1> idx_d, auto &acc){
+            auto speed_reduce = sycl::reduction(buf_maxSpeed, sycl::maximum<float>());
+            h.parallel_for(sycl::range<1>(endId), count_reduce, speed_reduce, [=](sycl::id<1> idx_d, auto &acc, auto &maxSpeed){
                 size_t idx = idx_d.get(0);
-                if(buf_acc[idx].alive == false)
+                if(alive_acc[idx] == 0)
                 {
                     return ;
                 }
                 acc++;
-                if(buf_acc[idx].time.x() < 0.0f && buf_acc[idx].alive == true)
+                if(buf_acc[idx].time.x() < 0.0f)
                 {
-                    buf_acc[idx].alive = false;
+                    alive_acc[idx] = 0;
                     // max += -1;
                     return ;
                 }
+                // a far particle that is not due sits this frame out, a due one catches up
+                const float lodScale = lod.valid() ? lod.scale(idx) : 1.0f;
+                if(lodScale == 0.0f)
+                    return ;
+                const float localDT = baseDT * lodScale;
 
-                buf_acc[idx].acc += globalA;
-    
-                buf_acc[idx].vel += localDT * buf_acc[idx].acc;
-        
-                buf_acc[idx].pos += localDT * buf_acc[idx].vel;
+                if(accCurve.valid())
+                {
+                    sycl::vec<float, 4> range = accCurve.eval(time);
+                    sycl::vec<float, 4> a = gustDT * lodScale * philox_rangef(sycl::vec<float, 4>(range.x()), sycl::vec<float, 4>(range.y()), seed, 0, frame, STREAM_GLOBAL_ACC);
+                    a.w() = 0.0f;
+                    buf_acc[idx].acc += a;
+                }
+                else
+                    buf_acc[idx].acc += globalA * lodScale;
     
-                if (buf_acc[idx].pos.y() > m_floorY)
+                const sycl::vec<float, 4> prevPos = buf_acc[idx].pos;
+                const float prevY = prevPos.y();
+                // the particle's own acc plus the turbulence at a point and time
+                auto accel = [&](const sycl::vec<float, 4> &at, float t){
+                    return curl.valid() ? buf_acc[idx].acc + curl.sample(at, t) : buf_acc[idx].acc;
+                };
+                switch (integrator)
+                {
+                case INTEGRATOR_EXPLICIT:
+                {
+                    sycl::vec<float, 4> a0 = accel(prevPos, time - localDT);
+                    buf_acc[idx].pos += localDT * buf_acc[idx].vel;
+                    buf_acc[idx].vel += localDT * a0;
+                    break;
+                }
+                case INTEGRATOR_VERLET:
+                {
+                    sycl::vec<float, 4> a0 = accel(prevPos, time - localDT);
+                    buf_acc[idx].pos += localDT * buf_acc[idx].vel + (0.5f * localDT * localDT) * a0;
+                    sycl::vec<float, 4> a1 = accel(buf_acc[idx].pos, time);
+                    buf_acc[idx].vel += (0.5f * localDT) * (a0 + a1);
+                    break;
+                }
+                case INTEGRATOR_RK2:
+                {
+                    // midpoint: the slope halfway through the step
+                    sycl::vec<float, 4> a0 = accel(prevPos, time - localDT);
+                    sycl::vec<float, 4> midPos = prevPos + (0.5f * localDT) * buf_acc[idx].vel;
+                    sycl::vec<float, 4> midVel = buf_acc[idx].vel + (0.5f * localDT) * a0;
+                    buf_acc[idx].pos += localDT * midVel;
+                    buf_acc[idx].vel += localDT * accel(midPos, time - 0.5f * localDT);
+                    break;
+                }
+                default:
+                    buf_acc[idx].vel += localDT * accel(prevPos, time);
+                    buf_acc[idx].pos += localDT * buf_acc[idx].vel;
+                    break;
+                }
+                // the flat floor, or the heightmap under the particle
+                sycl::vec<float, 4> into(0.0f, 1.0f, 0.0f, 0.0f);
+                const float groundY = terrain.valid() ? terrain.ground(buf_acc[idx].pos.x(), buf_acc[idx].pos.z(), m_floorY, into) : m_floorY;
+                if (buf_acc[idx].pos.y() > groundY)
                 {
                     sycl::vec<float, 4> force = buf_acc[idx].acc;
                     
-                    float normalFactor = sycl::dot(force, sycl::vec<float, 4>(0.0f, 1.0f, 0.0f, 0.0f));
+                    float normalFactor = sycl::dot(force, into);
                     if (normalFactor < 0.0f)
-                        force -= sycl::vec<float, 4>(0.0f, 1.0f, 0.0f, 0.0f) * normalFactor;
+                        force -= into * normalFactor;
     
-                    float velFactor = sycl::dot(buf_acc[idx].vel, sycl::vec<float, 4>(0.0f, 1.0f, 0.0f, 0.0f));
+                    float velFactor = sycl::dot(buf_acc[idx].vel, into);
+                    // only the frame it goes through the floor, not while it is still below
+                    if (splash.valid() && prevY <= groundY && velFactor > splashSpeed)
+                    {
+                        sycl::vec<float, 4> hit = buf_acc[idx].pos;
+                        hit.y() = groundY;
+                        splash.push(SplashRequest{ hit, buf_acc[idx].col, velFactor });
+                    }
                     //if (velFactor < 0.0)
-                    buf_acc[idx].vel -= sycl::vec<float, 4>(0.0f, 1.0f, 0.0f, 0.0f) * (1.0f + m_bounceFactor) * velFactor;
+                    buf_acc[idx].vel -= into * (1.0f + m_bounceFactor) * velFactor;
+                    // a slope would keep flipping a particle that ended up under it
+                    if (terrain.valid())
+                        buf_acc[idx].pos.y() = groundY;
     
                     buf_acc[idx].acc = force;
                 }
-                // sycl::vec<float, 4> off;
-                // float dist;
-                // size_t a = 0;    
-                // for (a = 0; a < countAttractors; ++a)
-                // {
-                //     off.x() = m_attractors_acc[a].x() - buf_acc[idx].pos.x();
-                //     off.y() = m_attractors_acc[a].y() - buf_acc[idx].pos.y();
-                //     off.z() = m_attractors_acc[a].z() - buf_acc[idx].pos.z();
-                //     dist = sycl::dot(off, off);
-    
-                //     //if (fabs(dist) > 0.00001)
-                //     dist = m_attractors_acc[a].w() / dist;
-    
-                //     buf_acc[idx].acc += off * dist;
-                // }
-    
+                if (sdf.valid())
+                {
+                    sycl::vec<float, 4> n;
+                    float d = sdf.distance(buf_acc[idx].pos, n);
+                    if (d < 0.0f)
+                    {
+                        buf_acc[idx].pos -= n * d;
+                        float vn = sycl::dot(buf_acc[idx].vel, n);
+                        if (vn < 0.0f)
+                        {
+                            sycl::vec<float, 4> normalVel = n * vn;
+                            buf_acc[idx].vel = (buf_acc[idx].vel - normalVel) * (1.0f - sdfFriction) - normalVel * sdfBounce;
+                        }
+                    }
+                }
+                if (mesh.valid())
+                {
+                    float t;
+                    sycl::vec<float, 4> n;
+                    if (mesh.segment(prevPos, buf_acc[idx].pos, t, n))
+                    {
+                        // back to the hit, a hair off the surface on the side it came from
+                        sycl::vec<float, 4> hit = prevPos + (buf_acc[idx].pos - prevPos) * t + n * 0.05f;
+                        hit.w() = buf_acc[idx].pos.w();
+                        buf_acc[idx].pos = hit;
+                        float vn = sycl::dot(buf_acc[idx].vel, n);
+                        if (vn < 0.0f)
+                        {
+                            sycl::vec<float, 4> normalVel = n * vn;
+                            buf_acc[idx].vel = (buf_acc[idx].vel - normalVel) * (1.0f - meshFriction) - normalVel * meshBounce;
+                        }
+                    }
+                }
                 buf_acc[idx].time.x() -= localDT;
                 // interpolation: from 0 (start of life) till 1 (end of life)
                 buf_acc[idx].time.z() = (float)1.0 - (buf_acc[idx].time.x()*buf_acc[idx].time.w()); // .w is 1.0/max life time		
                 
                 buf_acc[idx].col = sycl::mix(buf_acc[idx].startCol, buf_acc[idx].endCol, sycl::vec<float, 4>(buf_acc[idx].time.z()));
+                maxSpeed.combine(sycl::length(buf_acc[idx].vel) * lodScale);
             });
         }).wait();
 
         // q.wait();
         // p.m_countAlive = maxBuf.get_host_access()[0];
-        q.copy<size_t>(buf_countAlive, &p.m_countAlive, 1).wait();
+        q.copy<size_t>(buf_countAlive, &p.m_countAlive, 1);
+        q.copy<float>(buf_maxSpeed, &m_maxSpeed, 1);
+        q.wait();
+        if(m_colliders)
+            m_colliders->apply(p);
         // q.wait();
 
     }
 };
-
-
-
-
-// void FloorUpdater::update(double dt, ParticleData *p)
-// {
-
-// }
-
-
-// void AttractorUpdater::update(double dt, ParticleData *p)
-// {
-// const float localDT = (float)dt;
-
-
-// }
-
-// void BasicColorUpdater::update(double dt, ParticleData *p)
-// {
-// const size_t endId = p->m_countAlive;
-// for (size_t i = 0; i < endId; ++i)
-//     p->m_col[i] = glm::mix(p->m_startCol[i], p->m_endCol[i], p->m_time[i].z);
-// }
-
-// void PosColorUpdater::update(double dt, ParticleData *p)
-// {
-// const size_t endId = p->m_countAlive;
-// float scaler, scaleg, scaleb;
-// float diffr = m_maxPos.x - m_minPos.x;
-// float diffg = m_maxPos.y - m_minPos.y;
-// float diffb = m_maxPos.z - m_minPos.z;
-// for (size_t i = 0; i < endId; ++i)
-// {
-//     scaler = (p->m_pos[i].x - m_minPos.x) / diffr;
-//     scaleg = (p->m_pos[i].y - m_minPos.y) / diffg;
-//     scaleb = (p->m_pos[i].z - m_minPos.z) / diffb;
-//     p->m_col[i].r = scaler;// glm::mix(p->m_startCol[i].r, p->m_endCol[i].r, scaler);
-//     p->m_col[i].g = scaleg;// glm::mix(p->m_startCol[i].g, p->m_endCol[i].g, scaleg);
-//     p->m_col[i].b = scaleb;// glm::mix(p->m_startCol[i].b, p->m_endCol[i].b, scaleb);
-//     p->m_col[i].a = glm::mix(p->m_startCol[i].a, p->m_endCol[i].a, p->m_time[i].z);
-// }
-// }
-
-// void VelColorUpdater::update(double dt, ParticleData *p)
-// {
-// const size_t endId = p->m_countAlive;
-// float scaler, scaleg, scaleb;
-// float diffr = m_maxVel.x - m_minVel.x;
-// float diffg = m_maxVel.y - m_minVel.y;
-// float diffb = m_maxVel.z - m_minVel.z;
-// for (size_t i = 0; i < endId; ++i)
-// {
-//     scaler = (p->m_vel[i].x - m_minVel.x) / diffr;
-//     scaleg = (p->m_vel[i].y - m_minVel.y) / diffg;
-//     scaleb = (p->m_vel[i].z - m_minVel.z) / diffb;
-//     p->m_col[i].r = scaler;// glm::mix(p->m_startCol[i].r, p->m_endCol[i].r, scaler);
-//     p->m_col[i].g = scaleg;// glm::mix(p->m_startCol[i].g, p->m_endCol[i].g, scaleg);
-//     p->m_col[i].b = scaleb;// glm::mix(p->m_startCol[i].b, p->m_endCol[i].b, scaleb);
-//     p->m_col[i].a = glm::mix(p->m_startCol[i].a, p->m_endCol[i].a, p->m_time[i].z);
-// }
-// }
-
-// void BasicTimeUpdater::update(double dt, ParticleData *p)
-// {
-// unsigned int endId = p->m_countAlive;
-// const float localDT = (float)dt;
-
-// if (endId == 0) return;
-
-
-// }
\ No newline at end of file
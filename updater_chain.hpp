@@ -0,0 +1,343 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <string>
+#include "particle.hpp"
+#include "my_random.hpp"
+
+// the simple updaters as device functors. each stage works on a particle that
+// is already in registers, UpdaterChain<...> fuses them at compile time into
+// one kernel: the particle is loaded once, goes through every stage and is
+// stored once, no pass over the pool per updater. a stage returns false to
+// kill the particle, the stages after it are skipped.
+// ChainUpdater below picks one of a few precompiled chains at run time.
+
+// what a stage knows about the frame and the particle it is updating
+class UpdateCtx
+{
+public:
+    float dt;
+    float time; // simulation time
+    unsigned long long seed;
+    unsigned int frame;
+    size_t id; // slot being updated
+
+    // four uniform floats in [0, 1), one philox call per stream
+    sycl::vec<float, 4> rand(unsigned int stream) const
+    {
+        return philox_randf(seed, id, frame, stream);
+    }
+};
+
+// counts the life down, a particle past its life dies the next update
+class BasicTime
+{
+public:
+    bool update(Particle &pt, const UpdateCtx &ctx) const
+    {
+        if (pt.time.x() < 0.0f)
+            return false;
+        pt.time.x() -= ctx.dt;
+        // interpolation: from 0 (start of life) till 1 (end of life)
+        pt.time.z() = 1.0f - pt.time.x() * pt.time.w(); // .w is 1.0/max life time
+        return true;
+    }
+};
+
+// the random global gusts of EulerUpdater: one draw per frame, the same for
+// every particle, accumulated into acc
+class Gusts
+{
+public:
+    float m_accMin{ -50.0f };
+    float m_accMax{ 50.0f };
+
+    bool update(Particle &pt, const UpdateCtx &ctx) const
+    {
+        sycl::vec<float, 4> a = ctx.dt * philox_rangef(sycl::vec<float, 4>(m_accMin), sycl::vec<float, 4>(m_accMax), ctx.seed, 0, ctx.frame, STREAM_GLOBAL_ACC);
+        a.w() = 0.0f;
+        pt.acc += a;
+        return true;
+    }
+};
+
+// constant acceleration straight into the velocity, +y is down
+class Gravity
+{
+public:
+    sycl::vec<float, 4> m_gravity{ 0.0f, 200.0f, 0.0f, 0.0f };
+
+    bool update(Particle &pt, const UpdateCtx &ctx) const
+    {
+        pt.vel += ctx.dt * m_gravity;
+        return true;
+    }
+};
+
+const unsigned int ATTRACTOR_INLINE = 8;
+
+// a handful of point attractors (.w > 0) and repulsors (.w < 0) carried in
+// the kernel arguments, same pull as AttractorField. more than
+// ATTRACTOR_INLINE belong in an AttractorField pass.
+class Attractors
+{
+public:
+    sycl::vec<float, 4> m_points[ATTRACTOR_INLINE];
+    unsigned int m_count{ 0 };
+    float m_softening{ 1.0f };
+
+    bool add(const sycl::vec<float, 4> &attr)
+    {
+        if (m_count >= ATTRACTOR_INLINE)
+            return false;
+        m_points[m_count++] = attr;
+        return true;
+    }
+
+    bool update(Particle &pt, const UpdateCtx &ctx) const
+    {
+        sycl::vec<float, 4> a(0.0f);
+        for (unsigned int j = 0; j < m_count; ++j)
+        {
+            sycl::vec<float, 4> off(m_points[j].x() - pt.pos.x(), m_points[j].y() - pt.pos.y(), m_points[j].z() - pt.pos.z(), 0.0f);
+            a += off * (m_points[j].w() / (sycl::dot(off, off) + m_softening));
+        }
+        pt.vel += ctx.dt * a;
+        return true;
+    }
+};
+
+// explicit euler step with the particle's own acc, what EulerUpdater does
+class Move
+{
+public:
+    bool update(Particle &pt, const UpdateCtx &ctx) const
+    {
+        pt.vel += ctx.dt * pt.acc;
+        pt.pos += ctx.dt * pt.vel;
+        return true;
+    }
+};
+
+// bounce off the flat floor, after Move
+class Floor
+{
+public:
+    float m_floorY{ 1000.0f };
+    float m_bounceFactor{ 2.0f };
+
+    bool update(Particle &pt, const UpdateCtx &) const
+    {
+        if (pt.pos.y() > m_floorY)
+        {
+            // no pull into the floor while on it
+            if (pt.acc.y() < 0.0f)
+                pt.acc.y() = 0.0f;
+            pt.vel.y() -= (1.0f + m_bounceFactor) * pt.vel.y();
+        }
+        return true;
+    }
+};
+
+class BasicColor
+{
+public:
+    bool update(Particle &pt, const UpdateCtx &) const
+    {
+        pt.col = sycl::mix(pt.startCol, pt.endCol, sycl::vec<float, 4>(pt.time.z()));
+        return true;
+    }
+};
+
+// rgb from where the particle is inside [m_minPos, m_maxPos], alpha still
+// fades over the life time
+class PosColor
+{
+public:
+    sycl::vec<float, 4> m_minPos{ -800.0f, 0.0f, -800.0f, 0.0f };
+    sycl::vec<float, 4> m_maxPos{ 800.0f, 1000.0f, 800.0f, 1.0f };
+
+    bool update(Particle &pt, const UpdateCtx &) const
+    {
+        sycl::vec<float, 4> scale = sycl::clamp((pt.pos - m_minPos) / (m_maxPos - m_minPos), 0.0f, 1.0f) * 255.0f;
+        scale.w() = pt.startCol.w() + (pt.endCol.w() - pt.startCol.w()) * pt.time.z();
+        pt.col = scale;
+        return true;
+    }
+};
+
+// same with the velocity inside [m_minVel, m_maxVel]
+class VelColor
+{
+public:
+    sycl::vec<float, 4> m_minVel{ -200.0f, -200.0f, -200.0f, 0.0f };
+    sycl::vec<float, 4> m_maxVel{ 200.0f, 200.0f, 200.0f, 1.0f };
+
+    bool update(Particle &pt, const UpdateCtx &) const
+    {
+        sycl::vec<float, 4> scale = sycl::clamp((pt.vel - m_minVel) / (m_maxVel - m_minVel), 0.0f, 1.0f) * 255.0f;
+        scale.w() = pt.startCol.w() + (pt.endCol.w() - pt.startCol.w()) * pt.time.z();
+        pt.col = scale;
+        return true;
+    }
+};
+
+// the parameters of every stage and nothing else, this is what gets copied
+// into the update kernel
+template<class... Stages>
+class UpdaterParams : public Stages...
+{
+public:
+    // in order, stops at the first stage that kills
+    bool update(Particle &pt, const UpdateCtx &ctx) const
+    {
+        return (Stages::update(pt, ctx) && ...);
+    }
+};
+
+template<class... Stages>
+struct sycl::is_device_copyable<UpdaterParams<Stages...>> : std::true_type {};
+
+// one fused kernel over [0, m_highWater): load, every stage, store. sets
+// m_countAlive to the particles that survived
+template<class... Stages>
+void run_chain(sycl::queue &q, const UpdaterParams<Stages...> &params, Particle_system &p, size_t *countAlive,
+               float dt, float time, unsigned long long seed, unsigned int frame)
+{
+    const unsigned int endId = p.m_highWater;
+    // nothing was ever handed out yet
+    if (endId == 0)
+    {
+        p.m_countAlive = 0;
+        return;
+    }
+    q.memset(countAlive, 0, sizeof(size_t)).wait();
+    q.submit([&](sycl::handler &h){
+        auto buf_acc = p.m_particle;
+        auto alive_acc = p.m_alive;
+        auto count_reduce = sycl::reduction(countAlive, sycl::plus<>());
+        h.parallel_for(sycl::range<1>(endId), count_reduce, [=](sycl::id<1> idx_d, auto &acc){
+            size_t idx = idx_d.get(0);
+            if (alive_acc[idx] == 0)
+                return;
+            Particle pt = buf_acc[idx];
+            if (!params.update(pt, UpdateCtx{ dt, time, seed, frame, idx }))
+            {
+                alive_acc[idx] = 0;
+                return;
+            }
+            buf_acc[idx] = pt;
+            acc++;
+        });
+    }).wait();
+    q.copy<size_t>(countAlive, &p.m_countAlive, 1).wait();
+}
+
+// e.g. UpdaterChain<BasicTime, Gravity, Attractors, Move, Floor, BasicColor>
+template<class... Stages>
+class UpdaterChain : public UpdaterParams<Stages...>
+{
+public:
+    unsigned long long m_seed{ 0 };
+    unsigned int m_frame{ 0 }; // philox counter, bumped once per update()
+    float m_time{ 0.0f }; // simulation time
+    sycl::queue q;
+private:
+    size_t *m_countAlive;
+public:
+    UpdaterChain(): q(sycl::gpu_selector_v)
+    {
+        m_countAlive = sycl::malloc_device<size_t>(1, q);
+    }
+    UpdaterChain(const UpdaterChain &) = delete;
+    UpdaterChain &operator=(const UpdaterChain &) = delete;
+    ~UpdaterChain()
+    {
+        sycl::free(m_countAlive, q);
+    }
+
+    void update(double dt, Particle_system &p)
+    {
+        m_time += (float)dt;
+        run_chain(q, static_cast<const UpdaterParams<Stages...> &>(*this), p, m_countAlive, (float)dt, m_time, m_seed, m_frame++);
+    }
+};
+
+// the precompiled chains ChainUpdater can switch between
+enum UpdaterPreset : unsigned int
+{
+    PRESET_RAIN,      // EulerUpdater without the extras: gusts, floor, start to end color
+    PRESET_GRAVITY,   // gravity instead of the gusts
+    PRESET_ATTRACT,   // the gusts and up to ATTRACTOR_INLINE attractors
+    PRESET_POS_COLOR, // rain colored by position
+    PRESET_VEL_COLOR, // rain colored by velocity
+    PRESET_COUNT
+};
+
+inline const char *updater_preset_name(UpdaterPreset preset)
+{
+    static const char *names[PRESET_COUNT] = { "rain", "gravity", "attract", "poscolor", "velcolor" };
+    return preset < PRESET_COUNT ? names[preset] : "";
+}
+
+inline bool updater_preset_from_name(const std::string &name, UpdaterPreset &preset)
+{
+    for (unsigned int i = 0; i < PRESET_COUNT; ++i)
+    {
+        if (name == updater_preset_name((UpdaterPreset)i))
+        {
+            preset = (UpdaterPreset)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// holds the parameters of every stage once and runs the chain of m_preset,
+// each preset is its own kernel compiled ahead of time
+class ChainUpdater : public BasicTime, public Gusts, public Gravity, public Attractors, public Move,
+                     public Floor, public BasicColor, public PosColor, public VelColor
+{
+public:
+    UpdaterPreset m_preset{ PRESET_RAIN };
+    unsigned long long m_seed{ 0 };
+    unsigned int m_frame{ 0 }; // philox counter, bumped once per update()
+    float m_time{ 0.0f }; // simulation time
+    sycl::queue q;
+private:
+    size_t *m_countAlive;
+public:
+    ChainUpdater(): q(sycl::gpu_selector_v)
+    {
+        m_countAlive = sycl::malloc_device<size_t>(1, q);
+    }
+    ChainUpdater(const ChainUpdater &) = delete;
+    ChainUpdater &operator=(const ChainUpdater &) = delete;
+    ~ChainUpdater()
+    {
+        sycl::free(m_countAlive, q);
+    }
+
+    void update(double dt, Particle_system &p)
+    {
+        m_time += (float)dt;
+        switch (m_preset)
+        {
+        case PRESET_RAIN:      run<BasicTime, Gusts, Move, Floor, BasicColor>(dt, p); break;
+        case PRESET_GRAVITY:   run<BasicTime, Gravity, Move, Floor, BasicColor>(dt, p); break;
+        case PRESET_ATTRACT:   run<BasicTime, Gusts, Attractors, Move, Floor, BasicColor>(dt, p); break;
+        case PRESET_POS_COLOR: run<BasicTime, Gusts, Move, Floor, PosColor>(dt, p); break;
+        case PRESET_VEL_COLOR: run<BasicTime, Gusts, Move, Floor, VelColor>(dt, p); break;
+        default: break;
+        }
+        m_frame++;
+    }
+
+private:
+    template<class... Stages>
+    void run(double dt, Particle_system &p)
+    {
+        // only the stages of this chain go into the kernel
+        const UpdaterParams<Stages...> params{ static_cast<const Stages &>(*this)... };
+        run_chain(q, params, p, m_countAlive, (float)dt, m_time, m_seed, m_frame);
+    }
+};
@@ -0,0 +1,448 @@
+#pragma once
+#include <sycl/sycl.hpp>
+#include <vector>
+#include <cmath>
+#include "particle.hpp"
+#include "my_random.hpp"
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// coarse eulerian air around the rain, cell-centred velocities on an
+// m_nx * m_ny * m_nz grid of cubic cells. every update():
+//  - particle to grid: the drops drag the air, a cell moves toward the mean
+//    velocity of its drops by w / (w + m_airMass), w being their weight
+//  - forces: relaxation toward the prevailing m_wind plus m_gustCount gusts,
+//    blobs drifting with the wind that fade in and out over m_gustPeriod
+//  - semi-lagrangian advection
+//  - pressure projection, jacobi iterations on local memory tiles
+//  - grid to particle, sideways only, the drops keep falling at their own
+//    speed: PIC, a drag toward the interpolated air velocity with m_drag,
+//    plus FLIP, m_flip of how much the air at the drop changed since the
+//    particle transfer
+// solid cells (add_box()) have no air velocity and walls for the pressure, the
+// faces of the grid are open. drops outside the grid feel only m_wind.
+
+const size_t WIND_TILE_X = 8;
+const size_t WIND_TILE_Y = 8;
+const size_t WIND_TILE_Z = 4;
+const size_t WIND_GROUP = WIND_TILE_X * WIND_TILE_Y * WIND_TILE_Z;
+
+class WindGrid
+{
+public:
+    sycl::vec<float, 4> m_origin{ -800.0f, -200.0f, -800.0f, 0.0f }; // lowest corner
+    float m_cellSize{ 50.0f };
+    sycl::vec<float, 4> m_wind{ 60.0f, 0.0f, 20.0f, 0.0f }; // prevailing wind
+    float m_windRelax{ 0.5f };    // 1 / seconds to get back to m_wind
+    float m_airMass{ 40.0f };     // a cell weighs this many drops
+    float m_drag{ 2.0f };         // 1 / seconds for a drop to pick up the air velocity
+    float m_flip{ 0.9f };         // share of the air's change the drops take at once, 0 is only the PIC drag
+    unsigned int m_iterations{ 30 };
+    size_t m_gustCount{ 8 };
+    float m_gustStrength{ 400.0f }; // acceleration at a gust's center
+    float m_gustRadius{ 150.0f };
+    float m_gustPeriod{ 4.0f };     // life of a gust, seconds
+    unsigned long long m_seed{ 0 };
+    float m_time{ 0.0f };
+    sycl::queue q;
+private:
+    size_t m_nx, m_ny, m_nz;
+    sycl::vec<float, 4> *m_vel{ nullptr };
+    sycl::vec<float, 4> *m_velOld{ nullptr }; // after the particle transfer, for FLIP
+    sycl::vec<float, 4> *m_velTmp{ nullptr };
+    float *m_p2g{ nullptr };                 // momentum xyz and weight per cell
+    float *m_div{ nullptr };
+    float *m_pressure{ nullptr };
+    float *m_pressureTmp{ nullptr };
+    unsigned char *m_solid{ nullptr };
+    sycl::vec<float, 4> *m_gusts{ nullptr }; // center (w radius) and acceleration per gust
+    std::vector<unsigned char> m_hostSolid;
+    bool m_solidDirty{ false };
+public:
+    WindGrid(size_t nx = 32, size_t ny = 24, size_t nz = 32): q(sycl::gpu_selector_v), m_nx(nx), m_ny(ny), m_nz(nz)
+    {
+        const size_t cells = m_nx * m_ny * m_nz;
+        m_vel = sycl::malloc_device<sycl::vec<float, 4>>(cells, q);
+        m_velOld = sycl::malloc_device<sycl::vec<float, 4>>(cells, q);
+        m_velTmp = sycl::malloc_device<sycl::vec<float, 4>>(cells, q);
+        m_p2g = sycl::malloc_device<float>(cells * 4, q);
+        m_div = sycl::malloc_device<float>(cells, q);
+        m_pressure = sycl::malloc_device<float>(cells, q);
+        m_pressureTmp = sycl::malloc_device<float>(cells, q);
+        m_solid = sycl::malloc_device<unsigned char>(cells, q);
+        m_gusts = sycl::malloc_device<sycl::vec<float, 4>>(2 * m_gustCount, q);
+        m_hostSolid.assign(cells, 0);
+        q.memset(m_solid, 0, cells).wait();
+        q.memset(m_pressure, 0, sizeof(float) * cells).wait();
+        reset();
+    }
+    WindGrid(const WindGrid &) = delete;
+    WindGrid &operator=(const WindGrid &) = delete;
+    ~WindGrid()
+    {
+        sycl::free(m_vel, q);
+        sycl::free(m_velOld, q);
+        sycl::free(m_velTmp, q);
+        sycl::free(m_p2g, q);
+        sycl::free(m_div, q);
+        sycl::free(m_pressure, q);
+        sycl::free(m_pressureTmp, q);
+        sycl::free(m_solid, q);
+        sycl::free(m_gusts, q);
+    }
+
+    // still air everywhere but the prevailing wind
+    void reset()
+    {
+        const size_t cells = m_nx * m_ny * m_nz;
+        std::vector<sycl::vec<float, 4>> v(cells, m_wind);
+        for (size_t n = 0; n < cells; ++n)
+            if (m_hostSolid[n]) v[n] = sycl::vec<float, 4>(0.0f);
+        q.memcpy(m_vel, v.data(), sizeof(sycl::vec<float, 4>) * cells).wait();
+    }
+
+    // marks every cell whose center is inside [bmin, bmax] solid, the wake
+    // shows up behind it
+    void add_box(const sycl::vec<float, 4> &bmin, const sycl::vec<float, 4> &bmax)
+    {
+        for (size_t k = 0; k < m_nz; ++k)
+        for (size_t j = 0; j < m_ny; ++j)
+        for (size_t i = 0; i < m_nx; ++i)
+        {
+            float x = m_origin.x() + (i + 0.5f) * m_cellSize;
+            float y = m_origin.y() + (j + 0.5f) * m_cellSize;
+            float z = m_origin.z() + (k + 0.5f) * m_cellSize;
+            if (x >= bmin.x() && x <= bmax.x() && y >= bmin.y() && y <= bmax.y() && z >= bmin.z() && z <= bmax.z())
+                m_hostSolid[(k * m_ny + j) * m_nx + i] = 1;
+        }
+        m_solidDirty = true;
+    }
+
+    void update(double dt, Particle_system &p)
+    {
+        if (m_solidDirty)
+        {
+            q.memcpy(m_solid, m_hostSolid.data(), m_hostSolid.size()).wait();
+            m_solidDirty = false;
+        }
+        const float localDT = (float)dt;
+        m_time += localDT;
+        upload_gusts();
+        particles_to_grid(p);
+        forces(localDT);
+        advect(localDT);
+        project();
+        grid_to_particles(localDT, p);
+    }
+
+private:
+    struct Dims
+    {
+        size_t nx, ny, nz;
+        sycl::vec<float, 4> origin;
+        float cell;
+
+        size_t at(size_t i, size_t j, size_t k) const { return (k * ny + j) * nx + i; }
+
+        // trilinear lookup at a world position, clamped to the cell centers
+        sycl::vec<float, 4> sample(const sycl::vec<float, 4> *grid, const sycl::vec<float, 4> &pos) const
+        {
+            float fx = sycl::clamp((pos.x() - origin.x()) / cell - 0.5f, 0.0f, (float)(nx - 1) - 0.001f);
+            float fy = sycl::clamp((pos.y() - origin.y()) / cell - 0.5f, 0.0f, (float)(ny - 1) - 0.001f);
+            float fz = sycl::clamp((pos.z() - origin.z()) / cell - 0.5f, 0.0f, (float)(nz - 1) - 0.001f);
+            size_t x = (size_t)fx, y = (size_t)fy, z = (size_t)fz;
+            float tx = fx - x, ty = fy - y, tz = fz - z;
+            sycl::vec<float, 4> c00 = sycl::mix(grid[at(x, y, z)], grid[at(x + 1, y, z)], sycl::vec<float, 4>(tx));
+            sycl::vec<float, 4> c10 = sycl::mix(grid[at(x, y + 1, z)], grid[at(x + 1, y + 1, z)], sycl::vec<float, 4>(tx));
+            sycl::vec<float, 4> c01 = sycl::mix(grid[at(x, y, z + 1)], grid[at(x + 1, y, z + 1)], sycl::vec<float, 4>(tx));
+            sycl::vec<float, 4> c11 = sycl::mix(grid[at(x, y + 1, z + 1)], grid[at(x + 1, y + 1, z + 1)], sycl::vec<float, 4>(tx));
+            sycl::vec<float, 4> c0 = sycl::mix(c00, c10, sycl::vec<float, 4>(ty));
+            sycl::vec<float, 4> c1 = sycl::mix(c01, c11, sycl::vec<float, 4>(ty));
+            return sycl::mix(c0, c1, sycl::vec<float, 4>(tz));
+        }
+
+        bool inside(const sycl::vec<float, 4> &pos) const
+        {
+            sycl::vec<float, 4> f = (pos - origin) / cell;
+            return f.x() >= 0.0f && f.x() < (float)nx && f.y() >= 0.0f && f.y() < (float)ny && f.z() >= 0.0f && f.z() < (float)nz;
+        }
+    };
+
+    Dims dims() const { return Dims{ m_nx, m_ny, m_nz, m_origin, m_cellSize }; }
+
+    // gust i lives in epochs of m_gustPeriod, shifted by i / m_gustCount of a
+    // period so they don't all start together
+    void upload_gusts()
+    {
+        std::vector<sycl::vec<float, 4>> gusts(2 * m_gustCount);
+        const sycl::vec<float, 4> extent((float)m_nx * m_cellSize, (float)m_ny * m_cellSize, (float)m_nz * m_cellSize, 0.0f);
+        for (size_t i = 0; i < m_gustCount; ++i)
+        {
+            float t = m_time / m_gustPeriod + (float)i / (float)m_gustCount;
+            unsigned int epoch = (unsigned int)t;
+            float age = t - (float)epoch; // 0 to 1 over the life of the gust
+            sycl::vec<float, 4> u = philox_randf(m_seed, i, epoch, STREAM_WIND);
+            sycl::vec<float, 4> d = philox_randf(m_seed, i + m_gustCount, epoch, STREAM_WIND);
+            sycl::vec<float, 4> center = m_origin + u * extent + m_wind * (age * m_gustPeriod);
+            center.w() = m_gustRadius;
+            // mostly sideways, rain gusts don't blow much up or down
+            sycl::vec<float, 4> dir(d.x() * 2.0f - 1.0f, (d.y() * 2.0f - 1.0f) * 0.2f, d.z() * 2.0f - 1.0f, 0.0f);
+            float len = std::sqrt(dir.x() * dir.x() + dir.y() * dir.y() + dir.z() * dir.z()) + 1e-6f;
+            gusts[2 * i] = center;
+            gusts[2 * i + 1] = dir * (m_gustStrength * std::sin((float)M_PI * age) / len);
+        }
+        if (m_gustCount > 0)
+            q.memcpy(m_gusts, gusts.data(), sizeof(sycl::vec<float, 4>) * gusts.size()).wait();
+    }
+
+    void particles_to_grid(Particle_system &p)
+    {
+        const size_t cells = m_nx * m_ny * m_nz;
+        q.memset(m_p2g, 0, sizeof(float) * cells * 4).wait();
+        const size_t endId = p.m_highWater;
+        if (endId == 0) return;
+        const Dims g = dims();
+        float *p2g = m_p2g;
+        const Particle *buf_acc = p.m_particle;
+        const unsigned char *alive_acc = p.m_alive;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if (alive_acc[idx] == 0) return;
+                const sycl::vec<float, 4> pos = buf_acc[idx].pos;
+                if (!g.inside(pos)) return;
+                const sycl::vec<float, 4> vel = buf_acc[idx].vel;
+                float fx = sycl::clamp((pos.x() - g.origin.x()) / g.cell - 0.5f, 0.0f, (float)(g.nx - 1) - 0.001f);
+                float fy = sycl::clamp((pos.y() - g.origin.y()) / g.cell - 0.5f, 0.0f, (float)(g.ny - 1) - 0.001f);
+                float fz = sycl::clamp((pos.z() - g.origin.z()) / g.cell - 0.5f, 0.0f, (float)(g.nz - 1) - 0.001f);
+                size_t x = (size_t)fx, y = (size_t)fy, z = (size_t)fz;
+                float tx = fx - x, ty = fy - y, tz = fz - z;
+                for (int c = 0; c < 8; ++c)
+                {
+                    int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+                    float w = (dx ? tx : 1.0f - tx) * (dy ? ty : 1.0f - ty) * (dz ? tz : 1.0f - tz);
+                    float *cell = p2g + 4 * g.at(x + dx, y + dy, z + dz);
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device> m_ref(cell[a]);
+                        m_ref.fetch_add(w * vel[a]);
+                    }
+                    sycl::atomic_ref<float, sycl::memory_order::relaxed, sycl::memory_scope::device> w_ref(cell[3]);
+                    w_ref.fetch_add(w);
+                }
+            });
+        }).wait();
+    }
+
+    void forces(float dt)
+    {
+        const size_t cells = m_nx * m_ny * m_nz;
+        const Dims g = dims();
+        const float airMass = m_airMass;
+        const float relax = 1.0f - std::exp(-m_windRelax * dt);
+        const sycl::vec<float, 4> wind = m_wind;
+        const size_t gustCount = m_gustCount;
+        const sycl::vec<float, 4> *gusts = m_gusts;
+        const float *p2g = m_p2g;
+        const unsigned char *solid = m_solid;
+        sycl::vec<float, 4> *vel = m_vel;
+        sycl::vec<float, 4> *velOld = m_velOld;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(cells), [=](sycl::id<1> idx_d){
+                size_t n = idx_d.get(0);
+                if (solid[n])
+                {
+                    vel[n] = velOld[n] = sycl::vec<float, 4>(0.0f);
+                    return;
+                }
+                sycl::vec<float, 4> v = vel[n];
+                const float w = p2g[4 * n + 3];
+                if (w > 0.0f)
+                {
+                    sycl::vec<float, 4> drops(p2g[4 * n] / w, p2g[4 * n + 1] / w, p2g[4 * n + 2] / w, 0.0f);
+                    v = sycl::mix(v, drops, sycl::vec<float, 4>(w / (w + airMass)));
+                }
+                velOld[n] = v;
+                v += (wind - v) * relax;
+                size_t i = n % g.nx, j = (n / g.nx) % g.ny, k = n / (g.nx * g.ny);
+                sycl::vec<float, 4> pos = g.origin + sycl::vec<float, 4>((i + 0.5f) * g.cell, (j + 0.5f) * g.cell, (k + 0.5f) * g.cell, 0.0f);
+                for (size_t s = 0; s < gustCount; ++s)
+                {
+                    sycl::vec<float, 4> c = gusts[2 * s];
+                    sycl::vec<float, 4> off = pos - c;
+                    off.w() = 0.0f;
+                    float r2 = sycl::dot(off, off) / (c.w() * c.w());
+                    if (r2 < 4.0f)
+                        v += gusts[2 * s + 1] * (dt * sycl::exp(-r2));
+                }
+                v.w() = 0.0f;
+                vel[n] = v;
+            });
+        }).wait();
+    }
+
+    void advect(float dt)
+    {
+        const size_t cells = m_nx * m_ny * m_nz;
+        const Dims g = dims();
+        const unsigned char *solid = m_solid;
+        const sycl::vec<float, 4> *vel = m_vel;
+        sycl::vec<float, 4> *out = m_velTmp;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(cells), [=](sycl::id<1> idx_d){
+                size_t n = idx_d.get(0);
+                if (solid[n])
+                {
+                    out[n] = sycl::vec<float, 4>(0.0f);
+                    return;
+                }
+                size_t i = n % g.nx, j = (n / g.nx) % g.ny, k = n / (g.nx * g.ny);
+                sycl::vec<float, 4> pos = g.origin + sycl::vec<float, 4>((i + 0.5f) * g.cell, (j + 0.5f) * g.cell, (k + 0.5f) * g.cell, 0.0f);
+                out[n] = g.sample(vel, pos - dt * vel[n]);
+            });
+        }).wait();
+        std::swap(m_vel, m_velTmp);
+    }
+
+    void project()
+    {
+        const size_t cells = m_nx * m_ny * m_nz;
+        const Dims g = dims();
+        const unsigned char *solid = m_solid;
+        sycl::vec<float, 4> *vel = m_vel;
+        float *div = m_div;
+
+        // central differences, walls have no velocity and open faces copy the cell
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(cells), [=](sycl::id<1> idx_d){
+                size_t n = idx_d.get(0);
+                if (solid[n])
+                {
+                    div[n] = 0.0f;
+                    return;
+                }
+                int i = (int)(n % g.nx), j = (int)((n / g.nx) % g.ny), k = (int)(n / (g.nx * g.ny));
+                const sycl::vec<float, 4> self = vel[n];
+                auto nb = [&](int x, int y, int z){
+                    if (x < 0 || y < 0 || z < 0 || x >= (int)g.nx || y >= (int)g.ny || z >= (int)g.nz) return self;
+                    size_t m = g.at(x, y, z);
+                    return solid[m] ? sycl::vec<float, 4>(0.0f) : vel[m];
+                };
+                div[n] = (nb(i + 1, j, k).x() - nb(i - 1, j, k).x()
+                        + nb(i, j + 1, k).y() - nb(i, j - 1, k).y()
+                        + nb(i, j, k + 1).z() - nb(i, j, k - 1).z()) / (2.0f * g.cell);
+            });
+        }).wait();
+
+        // the last frame's pressure is a good first guess
+        for (unsigned int it = 0; it < m_iterations; ++it)
+        {
+            jacobi(m_pressure, m_pressureTmp);
+            std::swap(m_pressure, m_pressureTmp);
+        }
+
+        const float *pressure = m_pressure;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(cells), [=](sycl::id<1> idx_d){
+                size_t n = idx_d.get(0);
+                if (solid[n]) return;
+                int i = (int)(n % g.nx), j = (int)((n / g.nx) % g.ny), k = (int)(n / (g.nx * g.ny));
+                const float self = pressure[n];
+                auto nb = [&](int x, int y, int z){
+                    if (x < 0 || y < 0 || z < 0 || x >= (int)g.nx || y >= (int)g.ny || z >= (int)g.nz) return 0.0f;
+                    size_t m = g.at(x, y, z);
+                    return solid[m] ? self : pressure[m];
+                };
+                sycl::vec<float, 4> grad(nb(i + 1, j, k) - nb(i - 1, j, k),
+                                         nb(i, j + 1, k) - nb(i, j - 1, k),
+                                         nb(i, j, k + 1) - nb(i, j, k - 1), 0.0f);
+                vel[n] -= grad / (2.0f * g.cell);
+            });
+        }).wait();
+    }
+
+    // one jacobi sweep of laplacian(p) = div. a work-group owns an 8x8x4 tile
+    // and stages it with a one cell halo (and the solid flags) in local memory,
+    // every pressure is read from global memory about once per sweep.
+    void jacobi(const float *in, float *out)
+    {
+        const size_t nx = m_nx, ny = m_ny, nz = m_nz;
+        const size_t tilesX = (nx + WIND_TILE_X - 1) / WIND_TILE_X;
+        const size_t tilesY = (ny + WIND_TILE_Y - 1) / WIND_TILE_Y;
+        const size_t tilesZ = (nz + WIND_TILE_Z - 1) / WIND_TILE_Z;
+        const size_t hx = WIND_TILE_X + 2, hy = WIND_TILE_Y + 2, hz = WIND_TILE_Z + 2;
+        const float h2 = m_cellSize * m_cellSize;
+        const unsigned char *solid = m_solid;
+        const float *div = m_div;
+        q.submit([&](sycl::handler &h){
+            sycl::local_accessor<float, 1> tile(sycl::range<1>(hx * hy * hz), h);
+            sycl::local_accessor<unsigned char, 1> wall(sycl::range<1>(hx * hy * hz), h);
+            h.parallel_for(sycl::nd_range<1>(tilesX * tilesY * tilesZ * WIND_GROUP, WIND_GROUP), [=](sycl::nd_item<1> it){
+                size_t grp = it.get_group(0);
+                size_t lid = it.get_local_id(0);
+                int bx = (int)((grp % tilesX) * WIND_TILE_X);
+                int by = (int)(((grp / tilesX) % tilesY) * WIND_TILE_Y);
+                int bz = (int)((grp / (tilesX * tilesY)) * WIND_TILE_Z);
+                // halo included, outside the grid is open air at pressure 0
+                for (size_t e = lid; e < hx * hy * hz; e += WIND_GROUP)
+                {
+                    int x = bx + (int)(e % hx) - 1;
+                    int y = by + (int)((e / hx) % hy) - 1;
+                    int z = bz + (int)(e / (hx * hy)) - 1;
+                    bool inGrid = x >= 0 && y >= 0 && z >= 0 && x < (int)nx && y < (int)ny && z < (int)nz;
+                    size_t m = inGrid ? ((size_t)z * ny + (size_t)y) * nx + (size_t)x : 0;
+                    tile[e] = inGrid ? in[m] : 0.0f;
+                    wall[e] = inGrid ? solid[m] : 0;
+                }
+                sycl::group_barrier(it.get_group());
+                int lx = (int)(lid % WIND_TILE_X), ly = (int)((lid / WIND_TILE_X) % WIND_TILE_Y), lz = (int)(lid / (WIND_TILE_X * WIND_TILE_Y));
+                int x = bx + lx, y = by + ly, z = bz + lz;
+                if (x >= (int)nx || y >= (int)ny || z >= (int)nz) return;
+                size_t n = ((size_t)z * ny + (size_t)y) * nx + (size_t)x;
+                size_t c = ((size_t)(lz + 1) * hy + (size_t)(ly + 1)) * hx + (size_t)(lx + 1);
+                if (wall[c])
+                {
+                    out[n] = 0.0f;
+                    return;
+                }
+                const float self = tile[c];
+                // a wall mirrors the cell's own pressure, no flow through it
+                auto nb = [&](size_t o){ return wall[o] ? self : tile[o]; };
+                float sum = nb(c - 1) + nb(c + 1) + nb(c - hx) + nb(c + hx) + nb(c - hx * hy) + nb(c + hx * hy);
+                out[n] = (sum - h2 * div[n]) / 6.0f;
+            });
+        }).wait();
+    }
+
+    void grid_to_particles(float dt, Particle_system &p)
+    {
+        const size_t endId = p.m_highWater;
+        if (endId == 0) return;
+        const Dims g = dims();
+        const float pull = 1.0f - std::exp(-m_drag * dt);
+        const float flip = m_flip;
+        const sycl::vec<float, 4> wind = m_wind;
+        const sycl::vec<float, 4> *vel = m_vel;
+        const sycl::vec<float, 4> *velOld = m_velOld;
+        Particle *buf_acc = p.m_particle;
+        const unsigned char *alive_acc = p.m_alive;
+        q.submit([&](sycl::handler &h){
+            h.parallel_for(sycl::range<1>(endId), [=](sycl::id<1> idx_d){
+                size_t idx = idx_d.get(0);
+                if (alive_acc[idx] == 0) return;
+                const sycl::vec<float, 4> pos = buf_acc[idx].pos;
+                const sycl::vec<float, 4> v = buf_acc[idx].vel;
+                // the drag is toward the air itself, the same inside and outside the grid
+                const bool inside = g.inside(pos);
+                const sycl::vec<float, 4> air = inside ? g.sample(vel, pos) : wind;
+                sycl::vec<float, 4> dv = (air - v) * pull;
+                if (inside)
+                    dv += (air - g.sample(velOld, pos)) * flip;
+                dv.y() = 0.0f;
+                dv.w() = 0.0f;
+                buf_acc[idx].vel += dv;
+            });
+        }).wait();
+    }
+};